@@ -0,0 +1,64 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <algorithm> // for std::max()
+#include <format> // for std::format()
+#include <functional> // for std::function
+
+#include "admission.h"
+#include "cache.h"
+#include "config.h"
+
+bool admission::init()
+{
+    m_min_size = g_config.get_size("admit_min_size", 0);
+    m_max_size = g_config.get_size("admit_max_size", 0);
+    m_max_fetch_time = std::max(g_config.get_int("admit_max_fetch_time", 0), int64_t(0)) / 1000.0f;
+    return m_min_size || m_max_size || m_max_fetch_time;
+}
+
+bool admission::admit(cache const &cache, size_t size)
+{
+    // An unknown retrieval cost counts as acceptable until it can be measured
+    bool ok = (!m_min_size || size >= m_min_size)
+               && (!m_max_size || size <= m_max_size)
+               && (!m_max_fetch_time || cache.retrieve_cost(size) <= m_max_fetch_time);
+
+    m_cache_rejects += !ok;
+    return ok;
+}
+
+void admission::count(size_t size, bool admitted)
+{
+    (admitted ? m_admitted : m_rejected) += 1;
+    (admitted ? m_admitted_bytes : m_rejected_bytes) += size;
+}
+
+void admission::summary() const
+{
+    extern std::function<void(char const *)> g_output_func;
+    g_output_func(std::format(" - Admission : {} admitted ({:.2f} MiB), {} rejected ({:.2f} MiB), {} cache rejects",
+                              m_admitted.load(), m_admitted_bytes / float(1 << 20),
+                              m_rejected.load(), m_rejected_bytes / float(1 << 20),
+                              m_cache_rejects.load()).c_str());
+}
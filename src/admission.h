@@ -0,0 +1,66 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+#include <atomic> // for std::atomic
+#include <string> // for std::string
+
+class cache;
+
+//
+// The admission class
+//
+// Decides whether an entry is worth publishing to a given remote cache, based
+// on its size and on how long it would take to retrieve it later. Local caches
+// always accept entries, so they are not subject to admission.
+//
+
+class admission
+{
+public:
+    // Initialise the admission policy; return false if it is disabled
+    bool init();
+
+    // Whether to send an entry of that size to a remote cache
+    bool admit(cache const &cache, size_t size);
+
+    // Record the outcome for an entry, once all remote caches were asked
+    void count(size_t size, bool admitted);
+
+    // Output statistics about admitted and rejected entries
+    void summary() const;
+
+private:
+    // Entries outside these bounds are not sent to remote caches
+    size_t m_min_size = 0, m_max_size = 0;
+
+    // Entries expected to take longer than this to retrieve, in seconds, are not
+    // sent to remote caches
+    float m_max_fetch_time = 0.0f;
+
+    // Statistics per entry, and rejections by a single cache
+    std::atomic<size_t> m_admitted = 0, m_admitted_bytes = 0;
+    std::atomic<size_t> m_rejected = 0, m_rejected_bytes = 0;
+    std::atomic<size_t> m_cache_rejects = 0;
+};
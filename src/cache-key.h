@@ -0,0 +1,77 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+#include <algorithm>   // for std::copy()
+#include <cstdint>     // for uint8_t
+#include <string_view> // for std::string_view
+
+//
+// The cache key class
+//
+// A cache ID together with its sharded relative path, e.g. "01/23/0123456789…",
+// computed once when the key is created and stored without any allocation.
+//
+
+class cache_key
+{
+public:
+    // Longest supported cache ID; FASTBuild IDs and blob IDs are much shorter
+    static constexpr size_t max_id_size = 160;
+
+    // Build a key from a cache ID; check valid() before using it
+    explicit cache_key(std::string_view id)
+    {
+        if (id.size() < 4 || id.size() > max_id_size)
+            return;
+
+        std::copy(id.begin(), id.begin() + 2, m_path);
+        m_path[2] = '/';
+        std::copy(id.begin() + 2, id.begin() + 4, m_path + 3);
+        m_path[5] = '/';
+        std::copy(id.begin(), id.end(), m_path + prefix_size);
+        m_size = uint8_t(prefix_size + id.size());
+    }
+
+    // Whether the ID could be stored in the key
+    bool valid() const { return m_size != 0; }
+
+    // The cache ID
+    std::string_view id() const { return path().substr(prefix_size); }
+
+    // The first directory of the path, e.g. "01"
+    std::string_view shard() const { return path().substr(0, 2); }
+
+    // The directory containing the entry, e.g. "01/23"
+    std::string_view dir() const { return path().substr(0, prefix_size - 1); }
+
+    // The relative path of the entry, e.g. "01/23/0123456789…"
+    std::string_view path() const { return std::string_view(m_path, m_size); }
+
+private:
+    static constexpr size_t prefix_size = 6;
+
+    char m_path[prefix_size + max_id_size];
+    uint8_t m_size = 0;
+};
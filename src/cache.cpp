@@ -21,33 +21,64 @@
 //  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 //
 
+#include <chrono> // for std::chrono
+
 #include "cache.h"
+#include "trace.h"
 
 // Initialise the cache
 bool cache::init(std::string const &cache_root)
 {
+    auto start = std::chrono::steady_clock::now();
     m_root = cache_root;
-    return init_internal(cache_root);
+    m_ready = init_internal(cache_root);
+
+    auto elapsed = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start);
+    log("{} {} after {:.0f} ms", cache_root, m_ready ? "ready" : "unavailable", elapsed.count());
+    return m_ready;
 }
 
 // Publish a cache entry
-bool cache::publish(std::filesystem::path const &path, std::string_view data)
+bool cache::publish(cache_key const &key, std::string_view data)
 {
+    trace::span span("publish", m_root.c_str(), key.id());
     auto timer = m_publish.start();
-    auto ret = publish_internal(path, data);
+
+    // Entries are content-addressed, so there is no need to send them again if
+    // the cache already has them
+    if (has_entry(key, data.size()))
+    {
+        m_publish.skip(timer, data.size());
+        return true;
+    }
+
+    auto ret = publish_internal(key, data);
     m_publish.stop(timer, ret, data.size());
     return ret;
 }
 
 // Retrieve a cache entry
-std::shared_ptr<std::string> cache::retrieve(std::filesystem::path const &path)
+std::shared_ptr<std::string> cache::retrieve(cache_key const &key)
 {
+    trace::span span("retrieve", m_root.c_str(), key.id());
     auto timer = m_retrieve.start();
-    auto ret = retrieve_internal(path);
+    auto ret = retrieve_internal(key);
     m_retrieve.stop(timer, bool(ret), ret ? ret->size() : 0);
     return ret;
 }
 
+// Estimate the cost of retrieving an entry
+float cache::retrieve_cost(size_t bytes) const
+{
+    // Uploads are a fair estimate of downloads until enough entries were retrieved
+    auto latency = m_retrieve.latency() ? m_retrieve.latency() : m_publish.latency();
+    auto bandwidth = m_retrieve.bandwidth() ? m_retrieve.bandwidth() : m_publish.bandwidth();
+    if (!latency || !bandwidth)
+        return 0.0f;
+
+    return latency + bytes / bandwidth;
+}
+
 // Print stats about the cache
 void cache::summary() const
 {
@@ -55,4 +86,6 @@ void cache::summary() const
     g_output_func(std::format(" - {}", m_root).c_str());
     g_output_func(std::format(" - Retrieve  : {}", m_retrieve.summary()).c_str());
     g_output_func(std::format(" - Publish   : {}", m_publish.summary()).c_str());
+    if (m_publish.skipped())
+        g_output_func(std::format(" - Skipped   : {}", m_publish.skip_summary()).c_str());
 }
@@ -23,11 +23,11 @@
 
 #pragma once
 
+#include <atomic> // for std::atomic
 #include <format> // for std::format()
 #include <string> // for std::string
 #include <functional> // for std::function
-#include <filesystem> // for std::filesystem::path
-
+#include "cache-key.h"
 #include "stats.h"
 
 //
@@ -42,33 +42,62 @@ public:
     // Initialise the cache
     bool init(std::string const &cache_root);
 
+    // Whether the cache was successfully initialised and can be used
+    bool ready() const { return m_ready; }
+
+    // Whether the cache is stored on this machine, and may be served to peers
+    virtual bool is_local() const { return false; }
+
+    // Whether entries may be published to the cache; read-only caches are skipped
+    virtual bool accepts_publish() const { return true; }
+
     // Publish a cache entry
-    bool publish(std::filesystem::path const &path, std::string_view data);
+    bool publish(cache_key const &key, std::string_view data);
 
     // Retrieve a cache entry
-    std::shared_ptr<std::string> retrieve(std::filesystem::path const &path);
+    std::shared_ptr<std::string> retrieve(cache_key const &key);
+
+    // Retrieve a cache entry on behalf of someone else, without counting it in
+    // the stats of this cache
+    std::shared_ptr<std::string> peek(cache_key const &key) { return retrieve_internal(key); }
+
+    // Estimated time to retrieve an entry of a given size, in seconds, based on
+    // recent transfers; zero if there were not enough transfers to tell
+    float retrieve_cost(size_t bytes) const;
 
     // Output statistics about this cache
-    void summary() const;
+    virtual void summary() const;
 
     // Output a message using the std::format syntax
     template<typename... T>
     static void log(std::format_string<T...> const &fmt, T&&... args)
     {
+        if (s_quiet)
+            return;
+
         extern std::function<void(char const *)> g_output_func;
         g_output_func((" - NetCache: " + std::format(fmt, std::forward<T>(args)...)).c_str());
     }
 
+    // Silence log() in the current thread, e.g. while retrying in the background
+    static inline thread_local bool s_quiet = false;
+
 protected:
     virtual bool init_internal(std::string const &cache_root) = 0;
 
-    virtual bool publish_internal(std::filesystem::path const &path, std::string_view data) = 0;
+    virtual bool publish_internal(cache_key const &key, std::string_view data) = 0;
 
-    virtual std::shared_ptr<std::string> retrieve_internal(std::filesystem::path const &path) = 0;
+    // Whether the cache is known to already have an entry, so that publishing it can be skipped
+    virtual bool has_entry(cache_key const &, size_t) { return false; }
+
+    virtual std::shared_ptr<std::string> retrieve_internal(cache_key const &key) = 0;
 
     // Store the cache root for stats formatting
     std::string m_root;
 
     // Track time and bytes spent retrieving and publishing
     stats m_retrieve, m_publish;
+
+    // Set once initialisation succeeded; lazy caches are initialised in the background
+    std::atomic<bool> m_ready = false;
 };
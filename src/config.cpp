@@ -0,0 +1,102 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <cctype>  // for std::toupper()
+#include <charconv> // for std::from_chars()
+#include <cstdlib> // for std::getenv(), std::strtoull()
+#include <sstream> // for std::stringstream
+#include <algorithm> // for std::ranges::replace()
+
+#include "config.h"
+
+config g_config;
+
+void config::init(std::string const &user_config)
+{
+    // Settings may be separated by spaces, commas or semicolons
+    std::string s = user_config;
+    std::ranges::replace(s, ',', ' ');
+    std::ranges::replace(s, ';', ' ');
+
+    std::stringstream ss(s);
+    for (std::string setting; ss >> setting; )
+    {
+        auto n = setting.find('=');
+        if (n == std::string::npos)
+            m_settings[setting] = "1";
+        else
+            m_settings[setting.substr(0, n)] = setting.substr(n + 1);
+    }
+}
+
+std::string config::get(std::string const &key, std::string const &def) const
+{
+    if (auto it = m_settings.find(key); it != m_settings.end())
+        return it->second;
+
+    // Fall back to the environment, e.g. FASTBUILD_CACHE_PUBLISH_CHECK_SIZE
+    std::string var = "FASTBUILD_CACHE_";
+    for (char ch : key)
+        var += char(std::toupper(ch));
+    if (auto val = std::getenv(var.c_str()); val && val[0])
+        return val;
+
+    return def;
+}
+
+size_t config::get_size(std::string const &key, size_t def) const
+{
+    auto val = get(key);
+    if (val.empty())
+        return def;
+
+    char *end;
+    size_t ret = std::strtoull(val.c_str(), &end, 10);
+    switch (std::toupper(*end))
+    {
+        case 'G': ret <<= 10; [[fallthrough]];
+        case 'M': ret <<= 10; [[fallthrough]];
+        case 'K': ret <<= 10;
+    }
+    return ret;
+}
+
+int64_t config::get_int(std::string const &key, int64_t def) const
+{
+    auto val = get(key);
+    int64_t ret = 0;
+    auto [end, error] = std::from_chars(val.data(), val.data() + val.size(), ret);
+    if (val.empty() || error != std::errc() || end != val.data() + val.size())
+        return def;
+
+    return ret;
+}
+
+bool config::get_bool(std::string const &key, bool def) const
+{
+    auto val = get(key);
+    if (val.empty())
+        return def;
+
+    return val != "0" && val != "false" && val != "no" && val != "off";
+}
@@ -0,0 +1,61 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+#include <string> // for std::string
+#include <unordered_map> // for std::unordered_map
+
+//
+// The plugin configuration class
+//
+// Settings are read from the FASTBuild plugin configuration string (the
+// .CachePluginDLLConfig setting entry), which is a list of key=value pairs,
+// or from FASTBUILD_CACHE_<KEY> environment variables.
+//
+
+class config
+{
+public:
+    // Parse the plugin configuration string
+    void init(std::string const &user_config);
+
+    // Get a string setting, or the default value if not set
+    std::string get(std::string const &key, std::string const &def = "") const;
+
+    // Get a size setting, with an optional K, M or G suffix
+    size_t get_size(std::string const &key, size_t def) const;
+
+    // Get an integer setting, or the default value if it is not a plain integer
+    int64_t get_int(std::string const &key, int64_t def) const;
+
+    // Get a boolean setting
+    bool get_bool(std::string const &key, bool def) const;
+
+private:
+    // Settings found in the plugin configuration string
+    std::unordered_map<std::string, std::string> m_settings;
+};
+
+// Global variable storing the plugin configuration
+extern config g_config;
@@ -0,0 +1,128 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <cstdlib> // for std::strtoull()
+#include <format> // for std::format()
+#include <functional> // for std::function
+
+#include "config.h"
+#include "dedup.h"
+#include "digest.h"
+
+// Header of references to blobs; cache entries produced by FASTBuild cannot start
+// with a null byte followed by this text
+static std::string_view const ref_magic("\0FBNC-REF\n", 10);
+
+bool dedup::init()
+{
+    m_min_size = g_config.get_size("dedup_size", 0);
+    m_cache_max = g_config.get_size("dedup_cache_size", 256 << 20);
+    return m_min_size != 0;
+}
+
+std::string dedup::blob_id(std::string_view data)
+{
+    return sha256_hex(data) + ".blob";
+}
+
+std::string dedup::make_ref(std::string const &blob_id, size_t size)
+{
+    return std::format("{}{}\n{}\n", ref_magic, blob_id, size);
+}
+
+bool dedup::parse_ref(std::string_view data, std::string &blob_id, size_t &size)
+{
+    if (!data.starts_with(ref_magic) || data.size() > 256)
+        return false;
+
+    data.remove_prefix(ref_magic.size());
+    auto n = data.find('\n');
+    if (n == std::string_view::npos)
+        return false;
+
+    blob_id = data.substr(0, n);
+    size = std::strtoull(std::string(data.substr(n + 1)).c_str(), nullptr, 10);
+    return true;
+}
+
+bool dedup::is_known(void const *cache, std::string const &blob_id) const
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto it = m_known.find(cache);
+    return it != m_known.end() && it->second.contains(blob_id);
+}
+
+void dedup::set_known(void const *cache, std::string const &blob_id)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_known[cache].insert(blob_id);
+}
+
+std::shared_ptr<std::string> dedup::find(std::string const &blob_id)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto it = m_blobs.find(blob_id);
+    if (it == m_blobs.end())
+        return nullptr;
+
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+    m_local_hits += 1;
+    return it->second->second;
+}
+
+void dedup::insert(std::string const &blob_id, std::shared_ptr<std::string> data)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (data->size() > m_cache_max || m_blobs.contains(blob_id))
+        return;
+
+    m_lru.emplace_front(blob_id, data);
+    m_blobs.insert({blob_id, m_lru.begin()});
+    m_cache_size += data->size();
+
+    // Evict least recently used blobs until we are within budget
+    while (m_cache_size > m_cache_max)
+    {
+        m_cache_size -= m_lru.back().second->size();
+        m_blobs.erase(m_lru.back().first);
+        m_lru.pop_back();
+    }
+}
+
+void dedup::count_publish(size_t logical, size_t stored)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_refs += 1;
+    m_logical += logical;
+    m_stored += stored;
+}
+
+void dedup::summary() const
+{
+    extern std::function<void(char const *)> g_output_func;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    g_output_func(std::format(" - Dedup     : {} refs, {:.2f} MiB logical, {:.2f} MiB stored, ratio {:.2f}, {} local hits",
+                              m_refs, m_logical / float(1 << 20), m_stored / float(1 << 20),
+                              m_stored ? float(m_logical) / m_stored : 0.0f, m_local_hits).c_str());
+}
@@ -0,0 +1,93 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+#include <list>   // for std::list
+#include <mutex>  // for std::mutex
+#include <memory> // for std::shared_ptr
+#include <string> // for std::string
+#include <unordered_map> // for std::unordered_map
+#include <unordered_set> // for std::unordered_set
+
+//
+// The deduplication class
+//
+// Payloads above a given size are stored once as content-addressed blobs, and
+// cache entries only contain a small reference to the blob.
+//
+
+class dedup
+{
+public:
+    // Initialise deduplication; return false if it is disabled
+    bool init();
+
+    // Whether a payload is large enough to be stored as a blob
+    bool wants(std::string_view data) const { return m_min_size && data.size() >= m_min_size; }
+
+    // Compute the cache ID of the blob storing a given payload
+    static std::string blob_id(std::string_view data);
+
+    // Create a reference to a blob
+    static std::string make_ref(std::string const &blob_id, size_t size);
+
+    // Parse a reference to a blob; return false if the data is not a reference
+    static bool parse_ref(std::string_view data, std::string &blob_id, size_t &size);
+
+    // Whether a blob is known to be stored in a given cache
+    bool is_known(void const *cache, std::string const &blob_id) const;
+
+    // Remember that a blob is stored in a given cache
+    void set_known(void const *cache, std::string const &blob_id);
+
+    // Get a blob from the local blob cache
+    std::shared_ptr<std::string> find(std::string const &blob_id);
+
+    // Store a blob in the local blob cache
+    void insert(std::string const &blob_id, std::shared_ptr<std::string> data);
+
+    // Track logical and actually stored bytes for the summary
+    void count_publish(size_t logical, size_t stored);
+
+    // Output statistics about deduplication
+    void summary() const;
+
+private:
+    // Payloads at least this large are stored as blobs
+    size_t m_min_size = 0;
+
+    // Blobs known to be stored in each cache
+    std::unordered_map<void const *, std::unordered_set<std::string>> m_known;
+
+    // Local blob cache, in least recently used order, and its size limit
+    std::list<std::pair<std::string, std::shared_ptr<std::string>>> m_lru;
+    std::unordered_map<std::string, decltype(m_lru)::iterator> m_blobs;
+    size_t m_cache_size = 0, m_cache_max = 0;
+
+    // Statistics
+    size_t m_refs = 0, m_logical = 0, m_stored = 0, m_local_hits = 0;
+
+    // Protect all members against concurrent writes
+    mutable std::mutex m_mutex;
+};
@@ -0,0 +1,65 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <openssl/evp.h>  // for EVP_Digest()
+#include <openssl/hmac.h> // for HMAC()
+
+#include "digest.h"
+
+std::string to_hex(std::string_view data)
+{
+    static char const digits[] = "0123456789abcdef";
+
+    std::string ret(data.size() * 2, '\0');
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        ret[i * 2] = digits[static_cast<unsigned char>(data[i]) >> 4];
+        ret[i * 2 + 1] = digits[data[i] & 0xf];
+    }
+    return ret;
+}
+
+std::string sha256_hex(std::string_view data)
+{
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int size = 0;
+    EVP_Digest(data.data(), data.size(), md, &size, EVP_sha256(), nullptr);
+    return to_hex(std::string_view(reinterpret_cast<char const *>(md), size));
+}
+
+std::string hmac_sha256(std::string_view key, std::string_view data)
+{
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int size = 0;
+    HMAC(EVP_sha256(), key.data(), int(key.size()), reinterpret_cast<unsigned char const *>(data.data()),
+         data.size(), md, &size);
+    return std::string(reinterpret_cast<char const *>(md), size);
+}
+
+uint64_t fnv1a(std::string_view data)
+{
+    uint64_t ret = 0xcbf29ce484222325;
+    for (unsigned char ch : data)
+        ret = (ret ^ ch) * 0x100000001b3;
+    return ret;
+}
@@ -0,0 +1,41 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+#include <cstdint> // for uint64_t
+#include <string> // for std::string
+#include <string_view> // for std::string_view
+
+// Compute the SHA-256 digest of some data, as a lowercase hexadecimal string
+std::string sha256_hex(std::string_view data);
+
+// Compute the HMAC-SHA-256 of some data, as raw bytes
+std::string hmac_sha256(std::string_view key, std::string_view data);
+
+// Convert binary data to a lowercase hexadecimal string
+std::string to_hex(std::string_view data);
+
+// Compute the 64-bit FNV-1a hash of some data; this is fast and stable across
+// platforms, but not suitable for content addressing
+uint64_t fnv1a(std::string_view data);
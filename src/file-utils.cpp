@@ -0,0 +1,213 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#if _WIN32
+#   include <windows.h> // for CreateFileW(), MapViewOfFile(), LockFileEx(), etc.
+#else
+#   include <fcntl.h>    // for open()
+#   include <unistd.h>   // for write(), fsync(), close()
+#   include <sys/file.h> // for flock()
+#   include <sys/mman.h> // for mmap(), munmap()
+#   include <sys/stat.h> // for fstat()
+#endif
+
+#include <algorithm> // for std::min()
+
+#include "file-utils.h"
+
+mapped_file::mapped_file(std::filesystem::path const &path)
+{
+#if _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return;
+
+    // The view keeps the file alive, so all handles can be closed right away
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+    {
+        if (HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr); mapping)
+        {
+            m_data = static_cast<char const *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            m_size = m_data ? size_t(size.QuadPart) : 0;
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+#else
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    // The mapping keeps the file alive, so the descriptor can be closed right away
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        if (void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0); p != MAP_FAILED)
+        {
+            m_data = static_cast<char const *>(p);
+            m_size = size_t(st.st_size);
+        }
+    }
+    close(fd);
+#endif
+}
+
+mapped_file::~mapped_file()
+{
+    if (!m_data)
+        return;
+
+#if _WIN32
+    UnmapViewOfFile(m_data);
+#else
+    munmap(const_cast<char *>(m_data), m_size);
+#endif
+}
+
+file_lock::file_lock(std::filesystem::path const &path)
+{
+#if _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return;
+
+    // Same single byte as locked_append(), far beyond the end of the file
+    OVERLAPPED ov = {};
+    ov.Offset = ov.OffsetHigh = 0xffffffff;
+    m_handle = file;
+    m_locked = LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, 1, 0, &ov);
+#else
+    m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    m_locked = m_fd >= 0 && flock(m_fd, LOCK_EX | LOCK_NB) == 0;
+#endif
+}
+
+file_lock::~file_lock()
+{
+    // Closing the file releases the lock
+#if _WIN32
+    if (m_handle)
+        CloseHandle(m_handle);
+#else
+    if (m_fd >= 0)
+        close(m_fd);
+#endif
+}
+
+bool durable_write(std::filesystem::path const &path, std::string_view data)
+{
+    bool ret = true;
+    auto tmp = path;
+    tmp += ".tmp";
+
+#if _WIN32
+    HANDLE file = CreateFileW(tmp.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    for (DWORD written = 0; ret && !data.empty(); data.remove_prefix(written))
+        ret = WriteFile(file, data.data(), DWORD(std::min(data.size(), size_t(1) << 30)),
+                        &written, nullptr) && written > 0;
+    ret = ret && FlushFileBuffers(file);
+    CloseHandle(file);
+#else
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+
+    for (ssize_t written = 0; ret && !data.empty(); data.remove_prefix(written))
+        ret = (written = write(fd, data.data(), data.size())) > 0;
+    ret = ret && fsync(fd) == 0;
+    close(fd);
+#endif
+
+    std::error_code ec;
+    if (ret)
+        std::filesystem::rename(tmp, path, ec);
+    if (!ret || ec.value() != 0)
+    {
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+bool locked_append(std::filesystem::path const &path, std::initializer_list<std::string_view> chunks)
+{
+    bool ret = true;
+
+#if _WIN32
+    HANDLE file = CreateFileW(path.c_str(), FILE_APPEND_DATA,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    // Lock a single byte far beyond the end of the file, so that the lock acts as
+    // a mutex and never prevents readers from accessing the actual data
+    OVERLAPPED ov = {};
+    ov.Offset = ov.OffsetHigh = 0xffffffff;
+    if (!LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &ov))
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    for (auto chunk : chunks)
+    {
+        for (DWORD written = 0; ret && !chunk.empty(); chunk.remove_prefix(written))
+            ret = WriteFile(file, chunk.data(), DWORD(std::min(chunk.size(), size_t(1) << 30)),
+                            &written, nullptr) && written > 0;
+    }
+
+    UnlockFileEx(file, 0, 1, 0, &ov);
+    CloseHandle(file);
+#else
+    int fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+
+    if (flock(fd, LOCK_EX) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    for (auto chunk : chunks)
+    {
+        for (ssize_t written = 0; ret && !chunk.empty(); chunk.remove_prefix(written))
+            ret = (written = write(fd, chunk.data(), chunk.size())) > 0;
+    }
+
+    flock(fd, LOCK_UN);
+    close(fd);
+#endif
+
+    return ret;
+}
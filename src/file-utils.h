@@ -0,0 +1,87 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+#include <string_view> // for std::string_view
+#include <filesystem> // for std::filesystem::path
+#include <initializer_list> // for std::initializer_list
+
+//
+// A read-only memory mapping of a whole file
+//
+
+class mapped_file
+{
+public:
+    mapped_file(std::filesystem::path const &path);
+    ~mapped_file();
+
+    mapped_file(mapped_file const &) = delete;
+    mapped_file &operator =(mapped_file const &) = delete;
+
+    // Mapped data, or nullptr if the file could not be mapped
+    char const *data() const { return m_data; }
+
+    // Size of the mapped data
+    size_t size() const { return m_size; }
+
+private:
+    char const *m_data = nullptr;
+    size_t m_size = 0;
+};
+
+//
+// An exclusive lock on a file, held for the lifetime of the object; the system
+// releases it if the process exits or crashes, so it also tells whether its
+// owner is still alive
+//
+
+class file_lock
+{
+public:
+    // Try to lock a file, creating it if necessary, without waiting
+    file_lock(std::filesystem::path const &path);
+    ~file_lock();
+
+    file_lock(file_lock const &) = delete;
+    file_lock &operator =(file_lock const &) = delete;
+
+    // Whether the lock was acquired
+    bool locked() const { return m_locked; }
+
+private:
+#if _WIN32
+    void *m_handle = nullptr;
+#else
+    int m_fd = -1;
+#endif
+    bool m_locked = false;
+};
+
+// Atomically replace the content of a file, making sure it reached the disk
+bool durable_write(std::filesystem::path const &path, std::string_view data);
+
+// Append data to a file, creating it if necessary, while holding an exclusive
+// lock on it so that writers from other processes never interleave their data
+bool locked_append(std::filesystem::path const &path, std::initializer_list<std::string_view> chunks);
@@ -24,7 +24,22 @@
 #include <fstream> // for std::[io]fstream
 #include <random>  // for std::minstd_rand
 
+#include "config.h"
 #include "filecache.h"
+#include "packfile.h"
+
+filecache::~filecache()
+{
+    if (m_compactor.joinable())
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_shutdown = true;
+        }
+        m_cv.notify_all();
+        m_compactor.join();
+    }
+}
 
 bool filecache::init_internal(std::string const &cache_root)
 {
@@ -35,20 +50,31 @@ bool filecache::init_internal(std::string const &cache_root)
         return false;
     }
 
+    // Small entries may be stored in pack files, which need background compaction
+    m_pack_size = g_config.get_size("pack_size", 0);
+    if (m_pack_size && !m_compactor.joinable())
+        m_compactor = std::thread(&filecache::compact_packs, this);
+
     cache::log("initialised file cache for {}", cache_root);
     return true;
 }
 
-bool filecache::publish_internal(std::filesystem::path const &path, std::string_view data)
+bool filecache::publish_internal(cache_key const &key, std::string_view data)
 {
     static std::minstd_rand rand;
 
+    if (data.size() < m_pack_size)
+    {
+        return get_pack(key.shard())->append(key.id(), data);
+    }
+
     std::error_code ec;
-    std::filesystem::path tmp = m_root / path;
+    std::filesystem::path path = m_root / key.path();
+    std::filesystem::path tmp = path;
     tmp += std::format(".tmp{:06x}", rand() & 0xffffff);
 
     // Ensure target directory exists
-    std::filesystem::create_directories(m_root / path.parent_path(), ec);
+    std::filesystem::create_directories(path.parent_path(), ec);
     if (ec.value() != 0)
     {
         return false;
@@ -71,7 +97,7 @@ bool filecache::publish_internal(std::filesystem::path const &path, std::string_
     file.close();
 
     // Move temporary file to destination; in case of failure, remove the temporary file
-    std::filesystem::rename(tmp, m_root / path, ec);
+    std::filesystem::rename(tmp, path, ec);
     if (ec.value() != 0)
     {
         std::filesystem::remove(tmp, ec);
@@ -81,15 +107,41 @@ bool filecache::publish_internal(std::filesystem::path const &path, std::string_
     return true;
 }
 
-std::shared_ptr<std::string> filecache::retrieve_internal(std::filesystem::path const &path)
+bool filecache::has_entry(cache_key const &key, size_t size)
+{
+    // Pack files cannot be pruned, so another agent sharing this cache may
+    // already have appended the entry
+    return size < m_pack_size && get_pack(key.shard())->find(key.id());
+}
+
+std::shared_ptr<std::string> filecache::retrieve_internal(cache_key const &key)
 {
-    std::ifstream file(m_root / path, std::ios::in | std::ios::binary);
+    // Small entries may live in pack files; schedule compaction if needed
+    if (m_pack_size)
+    {
+        auto pack = get_pack(key.shard());
+        auto buffer = pack->find(key.id());
+        if (pack->needs_compaction())
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_compact_queue.push_back(pack);
+            m_cv.notify_one();
+        }
+
+        if (buffer)
+        {
+            return buffer;
+        }
+    }
+
+    std::filesystem::path path = m_root / key.path();
+    std::ifstream file(path, std::ios::in | std::ios::binary);
     if (!file)
     {
         return nullptr;
     }
 
-    auto size = std::filesystem::file_size(m_root / path);
+    auto size = std::filesystem::file_size(path);
     auto buffer = std::make_shared<std::string>(size, '\0');
     file.read(buffer->data(), size);
     if (file.fail())
@@ -99,3 +151,43 @@ std::shared_ptr<std::string> filecache::retrieve_internal(std::filesystem::path
 
     return buffer;
 }
+
+std::shared_ptr<packfile> filecache::get_pack(std::string_view shard_name)
+{
+    // Shard names are short enough to never allocate
+    std::string shard(shard_name);
+
+    {
+        std::shared_lock<std::shared_mutex> lock(m_packs_mutex);
+        if (auto it = m_packs.find(shard); it != m_packs.end())
+            return it->second;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(m_packs_mutex);
+    if (auto it = m_packs.find(shard); it != m_packs.end())
+        return it->second;
+
+    std::error_code ec;
+    std::filesystem::create_directories(m_root / shard, ec);
+    auto pack = std::make_shared<packfile>(m_root / shard);
+    m_packs.insert({shard, pack});
+    return pack;
+}
+
+void filecache::compact_packs()
+{
+    for (;;)
+    {
+        std::shared_ptr<packfile> pack;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this]() { return m_shutdown || !m_compact_queue.empty(); });
+            if (m_shutdown)
+                return;
+            pack = m_compact_queue.front();
+            m_compact_queue.pop_front();
+        }
+
+        pack->compact();
+    }
+}
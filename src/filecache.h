@@ -23,9 +23,14 @@
 
 #pragma once
 
+#include <deque>  // for std::deque
 #include <memory> // for std::shared_ptr
 #include <string> // for std::string
+#include <thread> // for std::thread
 #include <filesystem> // for std::filesystem::path
+#include <shared_mutex> // for std::shared_mutex
+#include <unordered_map> // for std::unordered_map
+#include <condition_variable> // for std::condition_variable
 
 #include "cache.h"
 
@@ -35,17 +40,48 @@
 
 class filecache : public cache
 {
+public:
+    virtual ~filecache();
+
+    // File caches may be served to peers
+    virtual bool is_local() const { return true; }
+
 protected:
     // Initialise the file cache plugin
     virtual bool init_internal(std::string const &cache_root);
 
     // Publish a cache entry
-    virtual bool publish_internal(std::filesystem::path const &path, std::string_view data);
+    virtual bool publish_internal(cache_key const &key, std::string_view data);
+
+    // Entries already in a pack file must not be appended again
+    virtual bool has_entry(cache_key const &key, size_t size);
 
     // Retrieve a cache entry
-    virtual std::shared_ptr<std::string> retrieve_internal(std::filesystem::path const &path);
+    virtual std::shared_ptr<std::string> retrieve_internal(cache_key const &key);
+
+    // Get the pack file for the shard containing a given entry
+    std::shared_ptr<class packfile> get_pack(std::string_view shard);
+
+    // Compact pack files in the background
+    void compact_packs();
 
 private:
     // Path to the cache root
     std::filesystem::path m_root;
+
+    // Entries smaller than this are stored in pack files instead of individual files
+    size_t m_pack_size = 0;
+
+    // Pack files, indexed by shard name
+    std::unordered_map<std::string, std::shared_ptr<class packfile>> m_packs;
+
+    // Protect m_packs against concurrent writes
+    std::shared_mutex m_packs_mutex;
+
+    // Background compaction thread and its queue of pack files
+    std::thread m_compactor;
+    std::deque<std::shared_ptr<class packfile>> m_compact_queue;
+    std::condition_variable m_cv;
+    std::mutex m_mutex;
+    bool m_shutdown = false;
 };
@@ -0,0 +1,677 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#if __linux__
+#   include <netdb.h>         // for getaddrinfo()
+#   include <unistd.h>        // for read(), write(), close()
+#   include <netinet/in.h>    // for IPPROTO_TCP
+#   include <netinet/tcp.h>   // for TCP_NODELAY
+#   include <sys/epoll.h>     // for epoll_create1(), epoll_ctl(), epoll_wait()
+#   include <sys/eventfd.h>   // for eventfd()
+#   include <sys/socket.h>    // for socket(), connect(), sendmsg()
+#endif
+
+#include <algorithm> // for std::min(), std::max()
+#include <charconv> // for std::from_chars()
+#include <cerrno>  // for errno
+#include <cstdlib> // for std::atoi()
+
+#include "http-engine.h"
+
+// Inactivity delay after which a request fails, like the blocking client's read timeout
+static constexpr auto io_timeout = std::chrono::seconds(300);
+
+// Delay after which a request body is sent anyway if the server did not answer
+// an "Expect: 100-continue" header
+static constexpr auto continue_timeout = std::chrono::seconds(1);
+
+struct http_engine::request
+{
+    std::string head;
+    std::string_view body;
+    bool is_head = false;
+    bool idempotent = false;
+    bool retried = false;
+
+    // Whether the body waits for a "100 Continue" reply, and whether it came
+    bool expect = false;
+    bool continued = false;
+    std::promise<httplib::Result> promise;
+};
+
+struct http_engine::connection
+{
+    enum { connecting, idle, writing, waiting, reading, closed } state = connecting;
+    int fd = -1;
+
+    // Whether a previous request succeeded on this connection; servers may close
+    // idle keep-alive connections at any time, so such requests are retried once
+    bool reused = false;
+
+    std::unique_ptr<request> req;
+    size_t written = 0;
+    std::chrono::steady_clock::time_point deadline;
+
+    // Reply being parsed; once headers are parsed, bodies with a known length
+    // are read directly into the response
+    std::string in;
+    std::unique_ptr<httplib::Response> res;
+    bool chunked = false, keep_alive = true;
+    int64_t content_length = -1;
+    size_t chunk_pos = 0;
+};
+
+// Parse the status line and headers of a reply; returns false if they are incomplete
+static bool parse_headers(std::string &in, httplib::Response &res, size_t &end, bool &error)
+{
+    for (;;)
+    {
+        end = in.find("\r\n\r\n");
+        if (end == std::string::npos)
+            return false;
+
+        // Status line: HTTP/1.1 200 OK
+        std::string_view head(in.data(), end);
+        auto eol = head.find("\r\n");
+        auto status_line = head.substr(0, eol);
+        if (!status_line.starts_with("HTTP/1.") || status_line.size() < 12)
+        {
+            error = true;
+            return false;
+        }
+        res.version = status_line.substr(0, 8);
+        res.status = std::atoi(std::string(status_line.substr(9, 3)).c_str());
+        res.reason = status_line.size() > 13 ? status_line.substr(13) : std::string_view();
+        res.headers.clear();
+
+        // Headers: Name: value
+        for (head.remove_prefix(std::min(eol, head.size())); !head.empty(); )
+        {
+            head.remove_prefix(2);
+            auto line = head.substr(0, head.find("\r\n"));
+            head.remove_prefix(line.size());
+            if (auto colon = line.find(':'); colon != std::string_view::npos)
+            {
+                auto value = line.substr(colon + 1);
+                value.remove_prefix(std::min(value.find_first_not_of(" \t"), value.size()));
+                value = value.substr(0, value.find_last_not_of(" \t") + 1);
+                res.headers.insert({ std::string(line.substr(0, colon)), std::string(value) });
+            }
+        }
+
+        // Skip interim replies such as 100 Continue
+        if (res.status >= 100 && res.status < 200)
+        {
+            in.erase(0, end + 4);
+            continue;
+        }
+
+        end += 4;
+        return true;
+    }
+}
+
+http_engine::http_engine(std::string const &host, int port, size_t max_connections,
+                         std::chrono::milliseconds connection_timeout)
+  : m_host(host),
+    m_port(port),
+    m_max_connections(std::max(max_connections, size_t(1)))
+{
+    set_connection_timeout(connection_timeout);
+}
+
+void http_engine::set_connection_timeout(std::chrono::milliseconds timeout)
+{
+    m_connection_timeout = timeout.count() ? timeout : io_timeout;
+}
+
+bool http_engine::parse_content_length(std::string const &value, size_t &size)
+{
+    auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), size);
+    return error == std::errc() && end == value.data() + value.size() && size <= max_body_size;
+}
+
+#if __linux__
+
+http_engine::~http_engine()
+{
+    if (m_thread.joinable())
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_shutdown = true;
+        }
+        uint64_t one = 1;
+        [[maybe_unused]] auto n = ::write(m_wakeup, &one, sizeof(one));
+        m_thread.join();
+    }
+
+    if (m_wakeup >= 0)
+        ::close(m_wakeup);
+    if (m_epoll >= 0)
+        ::close(m_epoll);
+}
+
+bool http_engine::start()
+{
+    // IPv6 literals are written in brackets in URLs, but not for the resolver
+    auto host = m_host;
+    if (host.size() > 2 && host.starts_with('[') && host.ends_with(']'))
+        host = host.substr(1, host.size() - 2);
+
+    addrinfo hints = {}, *result = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), std::to_string(m_port).c_str(), &hints, &result) != 0 || !result)
+        return false;
+
+    auto address = reinterpret_cast<char const *>(result->ai_addr);
+    m_address.assign(address, address + result->ai_addrlen);
+    freeaddrinfo(result);
+
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    m_wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_epoll < 0 || m_wakeup < 0)
+        return false;
+
+    // The wakeup descriptor is the only one registered without a connection
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeup, &ev) != 0)
+        return false;
+
+    m_thread = std::thread(&http_engine::run, this);
+    return true;
+}
+
+// Parse the size line of a chunk: hex digits, optionally followed by extensions
+static bool parse_chunk_size(std::string_view line, size_t &size)
+{
+    auto [end, error] = std::from_chars(line.data(), line.data() + line.size(), size, 16);
+    if (error != std::errc() || end == line.data())
+        return false;
+
+    auto rest = line.substr(end - line.data());
+    return rest.empty() || rest.front() == ';' || rest.front() == ' ' || rest.front() == '\t';
+}
+
+std::future<httplib::Result> http_engine::submit(std::string head, std::string_view body, bool is_head)
+{
+    auto req = std::make_unique<request>();
+    req->head = std::move(head);
+    req->body = body;
+    req->is_head = is_head;
+    auto method = std::string_view(req->head).substr(0, req->head.find(' '));
+    req->idempotent = method == "GET" || method == "HEAD" || method == "PUT" || method == "OPTIONS";
+    req->expect = !body.empty() && req->head.find("\r\nExpect: 100-continue\r\n") != std::string::npos;
+    auto ret = req->promise.get_future();
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_shutdown)
+        {
+            req->promise.set_value(httplib::Result(nullptr, httplib::Error::Canceled));
+            return ret;
+        }
+        m_queue.push_back(std::move(req));
+    }
+
+    uint64_t one = 1;
+    [[maybe_unused]] auto n = ::write(m_wakeup, &one, sizeof(one));
+    return ret;
+}
+
+void http_engine::run()
+{
+    epoll_event events[64];
+
+    for (;;)
+    {
+        // Wake up regularly to check for timeouts
+        int count = epoll_wait(m_epoll, events, 64, 100);
+        for (int i = 0; i < count; ++i)
+        {
+            if (!events[i].data.ptr)
+            {
+                uint64_t value;
+                [[maybe_unused]] auto n = ::read(m_wakeup, &value, sizeof(value));
+                continue;
+            }
+
+            auto c = static_cast<connection *>(events[i].data.ptr);
+            if (c->state != connection::closed)
+                handle(*c, events[i].events);
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_shutdown)
+                break;
+            for (auto &req : m_queue)
+                m_pending.push_back(std::move(req));
+            m_queue.clear();
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        for (auto &c : m_connections)
+        {
+            if (!c->req || c->state == connection::closed || now <= c->deadline)
+                continue;
+
+            // Servers that ignore "Expect: 100-continue" simply wait for the body
+            if (c->state == connection::waiting)
+                send_body(*c);
+            else
+                fail(*c, c->state == connection::connecting ? httplib::Error::Connection
+                                                            : httplib::Error::Read);
+        }
+
+        // Free closed connections before reusing their slots
+        std::erase_if(m_connections, [](auto const &c) { return c->state == connection::closed; });
+        dispatch();
+        std::erase_if(m_connections, [](auto const &c) { return c->state == connection::closed; });
+    }
+
+    // Cancel everything that is still in flight
+    for (auto &c : m_connections)
+        if (c->state != connection::closed)
+            c->req ? fail(*c, httplib::Error::Canceled) : close(*c);
+    for (auto &req : m_pending)
+        req->promise.set_value(httplib::Result(nullptr, httplib::Error::Canceled));
+    for (auto &req : m_queue)
+        req->promise.set_value(httplib::Result(nullptr, httplib::Error::Canceled));
+    m_connections.clear();
+    m_pending.clear();
+    m_queue.clear();
+}
+
+void http_engine::dispatch()
+{
+    while (!m_pending.empty())
+    {
+        connection *c = nullptr;
+        for (auto &conn : m_connections)
+            if (conn->state == connection::idle)
+                c = conn.get();
+
+        if (!c)
+        {
+            size_t open = 0;
+            for (auto &conn : m_connections)
+                open += conn->state != connection::closed;
+            if (open >= m_max_connections)
+                return;
+
+            if (c = open_connection(); !c)
+            {
+                m_pending.front()->promise.set_value(httplib::Result(nullptr, httplib::Error::Connection));
+                m_pending.pop_front();
+                continue;
+            }
+        }
+
+        c->req = std::move(m_pending.front());
+        c->req->continued = false;
+        m_pending.pop_front();
+        c->written = 0;
+        c->in.clear();
+        c->res.reset();
+        if (c->state == connection::idle)
+        {
+            c->state = connection::writing;
+            c->deadline = std::chrono::steady_clock::now() + io_timeout;
+            watch(*c, EPOLLOUT);
+        }
+    }
+}
+
+http_engine::connection *http_engine::open_connection()
+{
+    auto address = reinterpret_cast<sockaddr const *>(m_address.data());
+    int fd = socket(address->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return nullptr;
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, address, socklen_t(m_address.size())) != 0 && errno != EINPROGRESS)
+    {
+        ::close(fd);
+        return nullptr;
+    }
+
+    auto c = std::make_unique<connection>();
+    c->fd = fd;
+    c->deadline = std::chrono::steady_clock::now() + m_connection_timeout.load();
+
+    // Connection completion is reported as writability
+    epoll_event ev = {};
+    ev.events = EPOLLOUT;
+    ev.data.ptr = c.get();
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+        ::close(fd);
+        return nullptr;
+    }
+
+    m_connections.push_back(std::move(c));
+    return m_connections.back().get();
+}
+
+void http_engine::handle(connection &c, uint32_t events)
+{
+    if (c.state == connection::connecting)
+    {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0 || error != 0)
+            return fail(c, httplib::Error::Connection);
+
+        c.state = connection::writing;
+        c.deadline = std::chrono::steady_clock::now() + io_timeout;
+    }
+
+    if (c.state == connection::writing)
+    {
+        if (!write_some(c))
+            return fail(c, httplib::Error::Write);
+        if (c.req->expect && !c.req->continued && c.written == c.req->head.size())
+        {
+            c.state = connection::waiting;
+            c.deadline = std::chrono::steady_clock::now() + continue_timeout;
+            watch(c, EPOLLIN | EPOLLRDHUP);
+        }
+        else if (c.written == c.req->head.size() + c.req->body.size())
+        {
+            c.state = connection::reading;
+            watch(c, EPOLLIN | EPOLLRDHUP);
+        }
+        return;
+    }
+
+    // Either send the body after "100 Continue", or read the final reply, e.g.
+    // a 412 to a conditional request, without ever sending the body
+    if (c.state == connection::waiting)
+    {
+        bool eof = false;
+        if (!read_some(c, eof))
+            return fail(c, httplib::Error::Read);
+
+        auto end = c.in.find("\r\n\r\n");
+        if (end == std::string::npos)
+            return eof ? fail(c, httplib::Error::Read) : void();
+
+        if (c.in.starts_with("HTTP/1.1 100 ") || c.in.starts_with("HTTP/1.0 100 "))
+        {
+            c.in.erase(0, end + 4);
+            return send_body(c);
+        }
+
+        c.state = connection::reading;
+    }
+
+    // The server may close idle connections, which we can only notice by reading
+    if (c.state == connection::idle)
+    {
+        return close(c);
+    }
+
+    if (c.state == connection::reading && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+    {
+        bool eof = false;
+        if (!read_some(c, eof))
+            return fail(c, httplib::Error::Read);
+
+        // Parse headers, then keep reading body data directly into the response
+        if (!c.res)
+        {
+            auto res = std::make_unique<httplib::Response>();
+            size_t end;
+            bool error = false;
+            if (!parse_headers(c.in, *res, end, error))
+                return error || eof ? fail(c, httplib::Error::Read) : void();
+
+            c.res = std::move(res);
+            auto connection = c.res->get_header_value("Connection");
+            c.keep_alive = c.res->version == "HTTP/1.0" ? connection == "keep-alive" : connection != "close";
+
+            // The server still expects the body we did not send
+            if (c.req->expect && !c.req->continued)
+                c.keep_alive = false;
+            c.chunked = c.res->get_header_value("Transfer-Encoding").find("chunked") != std::string::npos;
+            c.content_length = -1;
+            if (c.req->is_head || c.res->status == httplib::StatusCode::NoContent_204
+                 || c.res->status == httplib::StatusCode::NotModified_304)
+                c.content_length = 0;
+            else if (!c.chunked && c.res->has_header("Content-Length"))
+            {
+                // A bogus size must not be used to allocate memory in the I/O thread
+                size_t size;
+                if (!parse_content_length(c.res->get_header_value("Content-Length"), size))
+                    return fail(c, httplib::Error::Read);
+                c.content_length = int64_t(size);
+            }
+
+            if (c.chunked)
+            {
+                c.chunk_pos = end;
+            }
+            else
+            {
+                if (c.content_length > 0)
+                    c.res->body.reserve(c.content_length);
+                c.res->body.append(c.in, end);
+                c.in.clear();
+            }
+        }
+
+        if (c.chunked)
+        {
+            // Drop decoded input before waiting for more, so that it is not kept twice
+            auto wait = [&]()
+            {
+                c.in.erase(0, c.chunk_pos);
+                c.chunk_pos = 0;
+                return eof ? fail(c, httplib::Error::Read) : void();
+            };
+
+            // Decode complete chunks: size in hex, CRLF, data, CRLF; the last one is empty
+            for (;;)
+            {
+                auto eol = c.in.find("\r\n", c.chunk_pos);
+                if (eol == std::string::npos)
+                    return wait();
+
+                size_t size;
+                if (!parse_chunk_size(std::string_view(c.in).substr(c.chunk_pos, eol - c.chunk_pos), size))
+                    return fail(c, httplib::Error::Read);
+
+                if (size == 0)
+                {
+                    // Skip optional trailers up to the final empty line
+                    if (c.in.find("\r\n\r\n", eol) == std::string::npos)
+                        return wait();
+                    return complete(c);
+                }
+
+                if (auto left = c.in.size() - eol - 2; left < size || left - size < 2)
+                    return wait();
+                c.res->body.append(c.in, eol + 2, size);
+                c.chunk_pos = eol + 2 + size + 2;
+            }
+        }
+
+        if (c.content_length >= 0)
+        {
+            if (c.res->body.size() >= size_t(c.content_length))
+            {
+                c.res->body.resize(c.content_length);
+                return complete(c);
+            }
+            return eof ? fail(c, httplib::Error::Read) : void();
+        }
+
+        // Without a length, the body ends when the server closes the connection
+        if (eof)
+        {
+            c.keep_alive = false;
+            return complete(c);
+        }
+    }
+}
+
+void http_engine::send_body(connection &c)
+{
+    c.req->continued = true;
+    c.state = connection::writing;
+    c.deadline = std::chrono::steady_clock::now() + io_timeout;
+    watch(c, EPOLLOUT);
+}
+
+bool http_engine::write_some(connection &c)
+{
+    auto &req = *c.req;
+    auto total = req.expect && !req.continued ? req.head.size() : req.head.size() + req.body.size();
+    while (c.written < total)
+    {
+        iovec iov[2];
+        size_t count = 0;
+        if (c.written < req.head.size())
+            iov[count++] = { req.head.data() + c.written, req.head.size() - c.written };
+        if (auto offset = std::max(c.written, req.head.size()) - req.head.size(); offset < total - req.head.size())
+            iov[count++] = { const_cast<char *>(req.body.data()) + offset, req.body.size() - offset };
+
+        msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        auto n = sendmsg(c.fd, &msg, MSG_NOSIGNAL);
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+
+        c.written += size_t(n);
+        c.deadline = std::chrono::steady_clock::now() + io_timeout;
+    }
+
+    return true;
+}
+
+bool http_engine::read_some(connection &c, bool &eof)
+{
+    // Body data with a known length goes straight into the response
+    bool direct = c.res && !c.chunked;
+    auto &buffer = direct ? c.res->body : c.in;
+    for (;;)
+    {
+        // Never read past a known length, so that the presized body is not reallocated
+        auto size = buffer.size();
+        size_t want = 65536;
+        if (direct && c.content_length >= 0)
+        {
+            if (size >= size_t(c.content_length))
+                return true;
+            want = size_t(c.content_length) - size;
+        }
+
+        buffer.resize(size + want);
+        auto n = ::read(c.fd, buffer.data() + size, want);
+        buffer.resize(size + std::max(n, ssize_t(0)));
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+
+        c.deadline = std::chrono::steady_clock::now() + io_timeout;
+        if (n == 0)
+        {
+            eof = true;
+            return true;
+        }
+    }
+}
+
+void http_engine::complete(connection &c)
+{
+    c.req->promise.set_value(httplib::Result(std::move(c.res), httplib::Error::Success));
+    c.req.reset();
+    c.in.clear();
+    c.reused = true;
+
+    if (!c.keep_alive)
+        return close(c);
+
+    c.state = connection::idle;
+    watch(c, EPOLLIN | EPOLLRDHUP);
+}
+
+void http_engine::fail(connection &c, httplib::Error error)
+{
+    // A stale keep-alive connection fails before any reply; try again on a new one,
+    // unless the request may have had side effects
+    if (c.req && c.reused && !c.res && c.in.empty() && c.req->idempotent && !c.req->retried
+         && error != httplib::Error::Canceled)
+    {
+        c.req->retried = true;
+        m_pending.push_front(std::move(c.req));
+    }
+    else if (c.req)
+    {
+        c.req->promise.set_value(httplib::Result(nullptr, error));
+        c.req.reset();
+    }
+
+    close(c);
+}
+
+void http_engine::watch(connection &c, uint32_t events)
+{
+    epoll_event ev = {};
+    ev.events = events;
+    ev.data.ptr = &c;
+    epoll_ctl(m_epoll, EPOLL_CTL_MOD, c.fd, &ev);
+}
+
+void http_engine::close(connection &c)
+{
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, c.fd, nullptr);
+    ::close(c.fd);
+    c.fd = -1;
+    c.state = connection::closed;
+}
+
+#else
+
+// Other platforms always use blocking clients
+http_engine::~http_engine() = default;
+
+bool http_engine::start()
+{
+    return false;
+}
+
+std::future<httplib::Result> http_engine::submit(std::string, std::string_view, bool)
+{
+    std::promise<httplib::Result> promise;
+    promise.set_value(httplib::Result(nullptr, httplib::Error::Unknown));
+    return promise.get_future();
+}
+
+#endif
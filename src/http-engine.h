@@ -0,0 +1,133 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+#define CPPHTTPLIB_OPENSSL_SUPPORT
+#include <httplib.h>
+
+#include <atomic> // for std::atomic
+#include <chrono> // for std::chrono
+#include <deque>  // for std::deque
+#include <future> // for std::future
+#include <memory> // for std::unique_ptr
+#include <mutex>  // for std::mutex
+#include <string> // for std::string
+#include <thread> // for std::thread
+#include <vector> // for std::vector
+#include <string_view> // for std::string_view
+
+//
+// Event-driven HTTP/1.1 client engine
+//
+// Requests from all threads are queued and sent over a small pool of
+// non-blocking keep-alive connections, all driven by a single I/O thread
+// using epoll; callers wait on futures. Only plain HTTP on Linux is
+// supported; elsewhere start() fails and callers use blocking clients.
+//
+
+class http_engine
+{
+public:
+    // Prepare an engine for a plain HTTP server, using at most a given number of connections
+    http_engine(std::string const &host, int port, size_t max_connections,
+                std::chrono::milliseconds connection_timeout);
+    ~http_engine();
+
+    http_engine(http_engine const &) = delete;
+    http_engine &operator =(http_engine const &) = delete;
+
+    // Resolve the server address and start the I/O thread
+    bool start();
+
+    // Set the timeout for new connections, or zero for the default
+    void set_connection_timeout(std::chrono::milliseconds timeout);
+
+    // Queue a request made of a serialised request line and headers, and a body
+    // that must stay alive until the reply arrives; replies to HEAD requests
+    // have no body even if they have a Content-Length header
+    std::future<httplib::Result> submit(std::string head, std::string_view body, bool is_head);
+
+    // Parse a Content-Length header value; fails on garbage, and on sizes that are
+    // too large to be a cache entry, so that they are never used to allocate memory
+    static bool parse_content_length(std::string const &value, size_t &size);
+
+    static constexpr size_t max_body_size = size_t(4) << 30;
+
+private:
+    struct request;
+    struct connection;
+
+    // I/O thread main loop
+    void run();
+
+    // Give queued requests to idle connections, opening new ones if allowed
+    void dispatch();
+
+    // Open a new connection to the server
+    connection *open_connection();
+
+    // Handle readiness events on a connection
+    void handle(connection &c, uint32_t events);
+
+    // Start sending the body of a request that waited for "100 Continue"
+    void send_body(connection &c);
+
+    // Send as much of the current request as possible; false on error
+    bool write_some(connection &c);
+
+    // Read as much of the reply as possible; false on error
+    bool read_some(connection &c, bool &eof);
+
+    // Finish the current request of a connection, successfully or not
+    void complete(connection &c);
+    void fail(connection &c, httplib::Error error);
+
+    // Change the events a connection waits for
+    void watch(connection &c, uint32_t events);
+
+    // Close a connection; it is freed at the end of the current loop iteration
+    void close(connection &c);
+
+    std::string m_host;
+    int m_port;
+    size_t m_max_connections;
+    std::atomic<std::chrono::milliseconds> m_connection_timeout;
+
+    // Resolved server address
+    std::vector<char> m_address;
+
+    // epoll instance, and eventfd used to wake up the I/O thread
+    int m_epoll = -1, m_wakeup = -1;
+
+    // Requests submitted by other threads
+    std::deque<std::unique_ptr<request>> m_queue;
+    std::mutex m_mutex;
+    bool m_shutdown = false;
+
+    // Only used by the I/O thread
+    std::deque<std::unique_ptr<request>> m_pending;
+    std::vector<std::unique_ptr<connection>> m_connections;
+
+    std::thread m_thread;
+};
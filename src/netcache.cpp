@@ -27,44 +27,96 @@
 #   include <stringapiset.h> // for WideCharToMultiByte()
 #endif
 
-#include <regex>  // for std::regex_match()
+#include <cctype>  // for std::tolower()
 #include <cstdlib> // for std::getenv()
-#include <algorithm> // for std::ranges::replace()
+#include <algorithm> // for std::ranges::equal(), std::ranges::replace()
 
+#include "config.h"
+#include "digest.h"
 #include "netcache.h"
+#include "trace.h"
 #include "webdav-client.h"
 
-bool netcache::init_internal(std::string const &cache_root)
+bool netcache::parse_url(std::string_view url, std::string &proto, std::string &server,
+                         std::string &port, std::string &root)
 {
-    auto match_webdav = std::regex("\\\\\\\\([^\\\\@]*)(@ssl)?(@[0-9]+)?(\\\\(davwwwroot\\\\)?.*)",
-                                   std::regex_constants::icase);
-    auto match_http = std::regex("^(https?://)([^/:]*)(:[0-9]+)?(.*)$");
+    auto icase_equal = [](char a, char b) { return std::tolower(a) == std::tolower(b); };
 
-    std::string proto, server, port;
-    std::smatch m;
-    // Split the cache path into protocol (HTTP/HTTPS), server, and path
-    if (std::regex_match(cache_root, m, match_webdav))
+    if (url.starts_with("\\\\"))
     {
-        proto = m[2].str().empty() ? "http://" : "https://";
-        server = m[1].str();
-        port = m[3].str();
-        std::ranges::replace(port, '@', ':');
-        m_root = std::filesystem::path(m[4].str());
+        // Windows WebDAV syntax: \\server[@ssl][@port]\path
+        url.remove_prefix(2);
+        auto n = url.find_first_of("\\@");
+        server = url.substr(0, n);
+        url.remove_prefix(std::min(n, url.size()));
+
+        proto = "http://";
+        if (url.size() >= 4 && std::ranges::equal(url.substr(0, 4), std::string_view("@ssl"), icase_equal))
+        {
+            proto = "https://";
+            url.remove_prefix(4);
+        }
+
+        port.clear();
+        if (url.starts_with('@'))
+        {
+            n = url.find_first_not_of("0123456789", 1);
+            if (n == 1 || n == std::string_view::npos)
+                return false;
+            port = ':' + std::string(url.substr(1, n - 1));
+            url.remove_prefix(n);
+        }
+
+        if (!url.starts_with('\\'))
+            return false;
     }
-    else if (std::regex_match(cache_root, m, match_http))
+    else if (url.starts_with("http://") || url.starts_with("https://"))
     {
-        proto = m[1].str();
-        server = m[2].str();
-        port = m[3].str();
-        m_root = std::filesystem::path(m[4].str());
+        // HTTP syntax: http[s]://server[:port][/path]
+        auto n = url.find("://") + 3;
+        proto = url.substr(0, n);
+        url.remove_prefix(n);
+
+        n = url.find_first_of("/:");
+        server = url.substr(0, n);
+        url.remove_prefix(std::min(n, url.size()));
+
+        port.clear();
+        if (url.starts_with(':'))
+        {
+            n = url.find_first_not_of("0123456789", 1);
+            if (n != 1)
+            {
+                n = std::min(n, url.size());
+                port = url.substr(0, n);
+                url.remove_prefix(n);
+            }
+        }
     }
     else
+    {
+        return false;
+    }
+
+    root = url;
+    return true;
+}
+
+bool netcache::init_internal(std::string const &cache_root)
+{
+    // Split the cache path into protocol (HTTP/HTTPS), server, and path
+    std::string proto, server, port, root;
+    if (!parse_url(cache_root, proto, server, port, root))
     {
         cache::log("unrecognised URL format {}", cache_root);
         return false;
     }
 
+    // Backslashes from the Windows WebDAV syntax are valid in URLs, but not meant as such
+    std::ranges::replace(root, '\\', '/');
+    m_root = root.substr(0, root.find_last_not_of('/') + 1);
     m_client = std::make_shared<webdav_client>(proto + server + port);
+    m_check_size = g_config.get_size("publish_check_size", 1 << 20);
 
     // Use credentials for the remote server if any are available
     auto user = std::getenv("FASTBUILD_CACHE_USERNAME");
@@ -95,8 +147,8 @@ bool netcache::init_internal(std::string const &cache_root)
 #endif
 
     // Attempt to connect and possibly authenticate to check that everything is working
-    cache::log("testing connection to {}", proto + server + port + m_root.generic_string());
-    auto res = m_client->options(m_root);
+    cache::log("testing connection to {}", proto + server + port + url(""));
+    auto res = m_client->options(url(""));
     if (!res)
     {
         cache::log("cannot query {} ({})", cache_root, httplib::to_string(res.error()));
@@ -108,51 +160,105 @@ bool netcache::init_internal(std::string const &cache_root)
         return false;
     }
 
+    // Let other threads use the connection we just opened, and open more if asked to
+    m_client->release();
+    if (int count = int(g_config.get_int("prewarm", 0)); count > 0)
+        m_client->prewarm(url(""), count);
+
     cache::log("initialised network cache for {}", cache_root);
     return true;
 }
 
-bool netcache::publish_internal(std::filesystem::path const &path, std::string_view data)
+void netcache::summary() const
 {
-    if (!ensure_directory(path.parent_path()))
+    cache::summary();
+
+    if (auto handshakes = m_client ? m_client->handshakes() : 0; handshakes)
+    {
+        extern std::function<void(char const *)> g_output_func;
+        g_output_func(std::format(" - TLS       : {} handshakes, {} resumed ({:.0f}%)", handshakes,
+                                  m_client->resumed(), 100.0f * m_client->resumed() / handshakes).c_str());
+    }
+}
+
+bool netcache::publish_internal(cache_key const &key, std::string_view data)
+{
+    if (!ensure_directory(key.dir()))
     {
         return false;
     }
 
-    auto res = m_client->put(m_root / path, data.data(), data.length());
-    if (!res || res->status != httplib::StatusCode::Created_201)
+    // Do not overwrite the entry if another client published it in the meantime
+    auto res = m_client->put(url(key.path()), data.data(), data.length(), false);
+    if (!res || (res->status != httplib::StatusCode::Created_201
+                  && res->status != httplib::StatusCode::PreconditionFailed_412))
     {
         return false;
     }
 
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_published.size() >= 100000)
+        m_published.clear();
+    m_published.insert(fnv1a(key.id()));
     return true;
 }
 
-std::shared_ptr<std::string> netcache::retrieve_internal(std::filesystem::path const &path)
+std::shared_ptr<std::string> netcache::retrieve_internal(cache_key const &key)
 {
-    auto res = m_client->get(m_root / path);
+    // Stream the body directly into the buffer that will be handed to FASTBuild
+    auto buffer = std::make_shared<std::string>();
+    auto res = m_client->get(url(key.path()), *buffer);
     if (!res || res->status != httplib::StatusCode::OK_200)
     {
         return nullptr;
     }
 
-    return std::make_shared<std::string>(std::move(res->body));
+    return buffer;
+}
+
+bool netcache::has_entry(cache_key const &key, size_t size)
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_published.contains(fnv1a(key.id())))
+            return true;
+    }
+
+    // Only ask the server for entries that are expensive enough to send
+    if (!m_check_size || size < m_check_size)
+    {
+        return false;
+    }
+
+    auto res = m_client->head(url(key.path()));
+    return res && res->status == httplib::StatusCode::OK_200;
 }
 
-bool netcache::ensure_directory(std::filesystem::path path)
+std::string const &netcache::url(std::string_view path) const
 {
+    // Requests are synchronous, so each thread can reuse a single buffer, which
+    // stops allocating once it is large enough
+    static thread_local std::string buffer;
+    return buffer.assign(m_root).append(1, '/').append(path);
+}
+
+bool netcache::ensure_directory(std::string_view dir)
+{
+    trace::span span("ensure_directory", cache::m_root.c_str(), dir);
+
     // Return true if the directory exists
-    auto res = m_client->propfind(m_root / path, "0");
+    auto res = m_client->propfind(url(dir), "0");
     if (res && res->status == httplib::StatusCode::MultiStatus_207)
     {
         return true;
     }
 
     // Otherwise, try to create it, but only after ensuring the parent directory exists
+    auto parent = dir.find_last_of('/');
     if (res && res->status == httplib::StatusCode::NotFound_404
-            && path.has_parent_path() && ensure_directory(path.parent_path()))
+            && (parent == std::string_view::npos || ensure_directory(dir.substr(0, parent))))
     {
-        res = m_client->mkcol(m_root / path);
+        res = m_client->mkcol(url(dir));
         return res && res->status == httplib::StatusCode::Created_201;
     }
 
@@ -23,9 +23,10 @@
 
 #pragma once
 
+#include <mutex>  // for std::mutex
 #include <memory> // for std::shared_ptr
 #include <string> // for std::string
-#include <filesystem> // for std::filesystem::path
+#include <unordered_set> // for std::unordered_set
 
 #include "cache.h"
 
@@ -35,23 +36,48 @@
 
 class netcache : public cache
 {
+public:
+    // Output statistics about this cache
+    virtual void summary() const;
+
+    // Split a network cache path into protocol, server, port, and root path;
+    // return false if the path does not point to a network location
+    static bool parse_url(std::string_view url, std::string &proto, std::string &server,
+                          std::string &port, std::string &root);
+
 protected:
     // Initialise the network cache plugin
     virtual bool init_internal(std::string const &cache_root);
 
     // Publish a cache entry
-    virtual bool publish_internal(std::filesystem::path const &path, std::string_view data);
+    virtual bool publish_internal(cache_key const &key, std::string_view data);
 
     // Retrieve a cache entry
-    virtual std::shared_ptr<std::string> retrieve_internal(std::filesystem::path const &path);
+    virtual std::shared_ptr<std::string> retrieve_internal(cache_key const &key);
+
+    // Check whether a given entry is known to exist on the server
+    virtual bool has_entry(cache_key const &key, size_t size);
 
     // Ensure that a given remote directory exists
-    bool ensure_directory(std::filesystem::path path);
+    bool ensure_directory(std::string_view dir);
+
+    // Full request path for a path relative to the cache root; it stays valid
+    // until the next call from the same thread
+    std::string const &url(std::string_view path) const;
 
 private:
-    // Path to the cache root on the server
-    std::filesystem::path m_root;
+    // Path to the cache root on the server, without a trailing slash
+    std::string m_root;
 
     // HTTP/WebDAV client
     std::shared_ptr<class webdav_client> m_client;
+
+    // Entries at least this large are checked for existence before being published
+    size_t m_check_size = 0;
+
+    // Hashes of recently published entries, to avoid publishing them again
+    std::unordered_set<uint64_t> m_published;
+
+    // Protect m_published against concurrent writes
+    std::mutex m_mutex;
 };
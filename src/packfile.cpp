@@ -0,0 +1,314 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <cstring> // for std::memcpy()
+#include <format>  // for std::format()
+#include <fstream> // for std::ofstream
+#include <random>  // for std::minstd_rand
+#include <vector>  // for std::vector
+#include <unordered_map> // for std::unordered_multimap
+
+#include "digest.h"
+#include "packfile.h"
+#include "file-utils.h"
+
+// Each entry in the pack file is a header, the entry ID, the entry data, and the
+// total entry size again, which allows to detect partially written entries.
+struct entry_header
+{
+    uint32_t magic;
+    uint32_t id_size;
+    uint64_t data_size;
+};
+
+// The index file is a header followed by an open addressing hash table; offsets
+// are stored plus one, so that zero means an empty slot.
+struct index_header
+{
+    uint32_t magic;
+    uint32_t slot_count;
+    uint64_t pack_size;
+};
+
+struct index_slot
+{
+    uint64_t hash;
+    uint64_t offset;
+};
+
+static constexpr uint32_t entry_magic = 0x504e4246; // "FBNP"
+static constexpr uint32_t index_magic = 0x494e4246; // "FBNI"
+
+// Index is rebuilt when that many entries are not covered by it
+static constexpr size_t max_tail_entries = 512;
+
+struct packfile::snapshot
+{
+    // Memory mappings of the pack file and its index
+    std::shared_ptr<mapped_file> pack, index;
+
+    // Modification time of the index when it was mapped
+    std::filesystem::file_time_type index_time;
+
+    // Part of the pack file covered by the index, and part that was scanned
+    uint64_t indexed = 0, scanned = 0;
+
+    // Entries found in the pack file after the indexed part
+    std::unordered_multimap<uint64_t, uint64_t> tail;
+};
+
+// Parse the entry at a given offset; return its total size, or zero if invalid
+static size_t parse_entry(char const *data, size_t size, size_t offset,
+                          std::string_view &id, std::string_view &payload)
+{
+    entry_header h;
+    if (offset > size || size - offset < sizeof(h) + sizeof(uint64_t))
+        return 0;
+
+    std::memcpy(&h, data + offset, sizeof(h));
+    if (h.magic != entry_magic || h.id_size > 1024 || h.data_size > size)
+        return 0;
+
+    uint64_t total = sizeof(h) + h.id_size + h.data_size + sizeof(uint64_t), footer;
+    if (total > size - offset)
+        return 0;
+
+    std::memcpy(&footer, data + offset + total - sizeof(footer), sizeof(footer));
+    if (footer != total)
+        return 0;
+
+    id = std::string_view(data + offset + sizeof(h), h.id_size);
+    payload = std::string_view(id.data() + h.id_size, h.data_size);
+    return total;
+}
+
+// Call a function for every valid entry between two offsets, skipping damaged
+// areas; return the offset where scanning should resume next time
+template<typename T>
+static size_t scan_entries(char const *data, size_t begin, size_t end, T fn)
+{
+    auto magic = std::string_view(reinterpret_cast<char const *>(&entry_magic), sizeof(entry_magic));
+
+    for (size_t offset = begin; offset < end; )
+    {
+        std::string_view id, payload;
+        if (auto size = parse_entry(data, end, offset, id, payload); size)
+        {
+            fn(offset, id);
+            offset += size;
+            continue;
+        }
+
+        // If no valid entry can be found later, this one may still be being written
+        auto next = std::string_view(data, end).find(magic, offset + 1);
+        for (; next != std::string_view::npos; next = std::string_view(data, end).find(magic, next + 1))
+            if (parse_entry(data, end, next, id, payload))
+                break;
+
+        if (next == std::string_view::npos)
+            return offset;
+        offset = next;
+    }
+
+    return end;
+}
+
+std::shared_ptr<std::string> packfile::lookup(snapshot const &s, std::string_view id, uint64_t hash)
+{
+    auto check = [&](uint64_t offset) -> std::shared_ptr<std::string>
+    {
+        std::string_view entry_id, payload;
+        if (!parse_entry(s.pack->data(), s.pack->size(), offset, entry_id, payload) || entry_id != id)
+            return nullptr;
+        return std::make_shared<std::string>(payload);
+    };
+
+    if (s.indexed)
+    {
+        index_header h;
+        std::memcpy(&h, s.index->data(), sizeof(h));
+
+        auto slots = reinterpret_cast<char const *>(s.index->data()) + sizeof(h);
+        for (uint32_t n = 0, i = hash & (h.slot_count - 1); n < h.slot_count; ++n, i = (i + 1) & (h.slot_count - 1))
+        {
+            index_slot slot;
+            std::memcpy(&slot, slots + i * sizeof(slot), sizeof(slot));
+            if (!slot.offset)
+                break;
+            if (slot.hash == hash)
+                if (auto ret = check(slot.offset - 1); ret)
+                    return ret;
+        }
+    }
+
+    for (auto [it, end] = s.tail.equal_range(hash); it != end; ++it)
+        if (auto ret = check(it->second); ret)
+            return ret;
+
+    return nullptr;
+}
+
+packfile::packfile(std::filesystem::path const &dir)
+  : m_pack(dir / "entries.pack"),
+    m_index(dir / "entries.idx")
+{
+    refresh(nullptr);
+    m_last_refresh = std::chrono::steady_clock::now();
+}
+
+bool packfile::append(std::string_view id, std::string_view data)
+{
+    entry_header h { entry_magic, uint32_t(id.size()), data.size() };
+    uint64_t total = sizeof(h) + id.size() + data.size() + sizeof(uint64_t);
+
+    return locked_append(m_pack, {
+        std::string_view(reinterpret_cast<char const *>(&h), sizeof(h)), id, data,
+        std::string_view(reinterpret_cast<char const *>(&total), sizeof(total)),
+    });
+}
+
+std::shared_ptr<std::string> packfile::find(std::string_view id)
+{
+    auto hash = fnv1a(id);
+    auto s = m_snapshot.load();
+    if (auto ret = lookup(*s, id, hash); ret)
+        return ret;
+
+    // Other processes may have appended to the pack file since our last lookup;
+    // check again, but not more than once per second.
+    auto now = std::chrono::steady_clock::now();
+    if (now - m_last_refresh.load() < std::chrono::seconds(1))
+        return nullptr;
+
+    m_last_refresh = now;
+    return lookup(*refresh(s), id, hash);
+}
+
+bool packfile::needs_compaction()
+{
+    // Do not retry too often if the previous compaction could not replace the index
+    auto now = std::chrono::steady_clock::now();
+    if (m_snapshot.load()->tail.size() < max_tail_entries || now - m_last_compaction.load() < std::chrono::minutes(1))
+        return false;
+
+    return !m_compacting.exchange(true);
+}
+
+void packfile::compact()
+{
+    static std::minstd_rand rand;
+
+    mapped_file pack(m_pack);
+    std::vector<index_slot> entries;
+    auto indexed = scan_entries(pack.data(), 0, pack.size(), [&](uint64_t offset, std::string_view id)
+    {
+        entries.push_back({ fnv1a(id), offset + 1 });
+    });
+
+    // Keep the load factor of the hash table below 50%
+    uint32_t slot_count = 64;
+    while (slot_count < entries.size() * 2)
+        slot_count *= 2;
+
+    std::vector<index_slot> slots(slot_count);
+    for (auto const &entry : entries)
+    {
+        auto i = entry.hash & (slot_count - 1);
+        while (slots[i].offset)
+            i = (i + 1) & (slot_count - 1);
+        slots[i] = entry;
+    }
+
+    // Write the index to a temporary file, then atomically replace the old one;
+    // this may fail on Windows while another process has the index mapped, in
+    // which case we will simply try again later.
+    std::error_code ec;
+    std::filesystem::path tmp = m_index;
+    tmp += std::format(".tmp{:06x}", rand() & 0xffffff);
+
+    index_header h { index_magic, slot_count, indexed };
+    std::ofstream file(tmp, std::ios::out | std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<char const *>(&h), sizeof(h));
+    file.write(reinterpret_cast<char const *>(slots.data()), slots.size() * sizeof(index_slot));
+    file.close();
+
+    if (file.fail())
+        std::filesystem::remove(tmp, ec);
+    else if (std::filesystem::rename(tmp, m_index, ec); ec.value() != 0)
+        std::filesystem::remove(tmp, ec);
+
+    refresh(m_snapshot.load());
+    m_last_compaction = std::chrono::steady_clock::now();
+    m_compacting = false;
+}
+
+std::shared_ptr<packfile::snapshot const> packfile::refresh(std::shared_ptr<snapshot const> const &prev)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // Another thread may have refreshed the snapshot while we were waiting
+    if (auto current = m_snapshot.load(); prev && current != prev)
+        return current;
+
+    auto s = std::make_shared<snapshot>();
+    std::error_code ec;
+
+    // Only map the index again if it was replaced
+    s->index_time = std::filesystem::last_write_time(m_index, ec);
+    if (prev && s->index_time == prev->index_time)
+        s->index = prev->index;
+    else
+        s->index = std::make_shared<mapped_file>(m_index);
+
+    // Only map the pack file again if it grew
+    auto pack_size = std::filesystem::file_size(m_pack, ec);
+    if (prev && !ec && pack_size == prev->pack->size())
+        s->pack = prev->pack;
+    else
+        s->pack = std::make_shared<mapped_file>(m_pack);
+
+    // Ignore the index if it looks invalid or does not match the pack file
+    index_header h {};
+    if (s->index->size() >= sizeof(h))
+        std::memcpy(&h, s->index->data(), sizeof(h));
+    if (h.magic == index_magic && h.slot_count && (h.slot_count & (h.slot_count - 1)) == 0
+         && s->index->size() >= sizeof(h) + h.slot_count * sizeof(index_slot)
+         && h.pack_size <= s->pack->size())
+        s->indexed = h.pack_size;
+
+    // Scan the rest of the pack file, starting where the previous scan stopped
+    // if the index did not change
+    s->scanned = s->indexed;
+    if (prev && s->index == prev->index && prev->scanned >= s->indexed)
+    {
+        s->tail = prev->tail;
+        s->scanned = prev->scanned;
+    }
+    s->scanned = scan_entries(s->pack->data(), s->scanned, s->pack->size(), [&](uint64_t offset, std::string_view id)
+    {
+        s->tail.insert({ fnv1a(id), offset });
+    });
+
+    m_snapshot = s;
+    return s;
+}
@@ -0,0 +1,83 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+#include <atomic> // for std::atomic
+#include <chrono> // for std::chrono
+#include <memory> // for std::shared_ptr
+#include <mutex>  // for std::mutex
+#include <string> // for std::string
+#include <filesystem> // for std::filesystem::path
+
+//
+// A pack file storing many small cache entries in a single append-only file,
+// together with an on-disk hash index that is periodically rebuilt
+//
+
+class packfile
+{
+public:
+    packfile(std::filesystem::path const &dir);
+
+    // Append an entry to the pack file
+    bool append(std::string_view id, std::string_view data);
+
+    // Find an entry in the pack file; this never waits for writers
+    std::shared_ptr<std::string> find(std::string_view id);
+
+    // Return true, only once, when enough entries are missing from the index
+    // that it should be rebuilt
+    bool needs_compaction();
+
+    // Rebuild the on-disk index so that it covers the whole pack file
+    void compact();
+
+protected:
+    // An immutable view of the pack file and its index at a given time
+    struct snapshot;
+
+    // Create a new snapshot, reusing data from the previous one when possible
+    std::shared_ptr<snapshot const> refresh(std::shared_ptr<snapshot const> const &prev);
+
+    // Look up an entry in the on-disk index and the scanned tail of a snapshot
+    static std::shared_ptr<std::string> lookup(snapshot const &s, std::string_view id, uint64_t hash);
+
+private:
+    // Paths to the pack file and its index
+    std::filesystem::path m_pack, m_index;
+
+    // Latest snapshot, shared by all readers
+    std::atomic<std::shared_ptr<snapshot const>> m_snapshot;
+
+    // Time of the last refresh caused by a lookup miss
+    std::atomic<std::chrono::steady_clock::time_point> m_last_refresh;
+
+    // Whether a compaction was requested and has not finished yet, and when the
+    // last one finished
+    std::atomic<bool> m_compacting = false;
+    std::atomic<std::chrono::steady_clock::time_point> m_last_compaction;
+
+    // Serialise snapshot refreshes
+    std::mutex m_mutex;
+};
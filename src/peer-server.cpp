@@ -0,0 +1,111 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#define CPPHTTPLIB_OPENSSL_SUPPORT
+#include <httplib.h>
+
+#include <cctype> // for std::isalnum()
+#include <format> // for std::format()
+
+#include "cache.h"
+#include "peer-server.h"
+
+// Check that a request path follows the sharded layout of cache entries, so
+// that peers can never read anything else
+static bool is_valid(std::string_view url, cache_key const &key)
+{
+    auto id = key.id();
+    if (!key.valid() || id.starts_with('.') || id.find("..") != std::string_view::npos
+         || !url.starts_with('/') || url.substr(1) != key.path())
+        return false;
+
+    for (char ch : id)
+        if (!std::isalnum(static_cast<unsigned char>(ch)) && ch != '-' && ch != '_' && ch != '.')
+            return false;
+
+    return true;
+}
+
+bool peer_server::start(std::string const &address, lookup_func lookup)
+{
+    auto n = address.rfind(':');
+    if (n == std::string::npos)
+    {
+        cache::log("invalid peer server address {}", address);
+        return false;
+    }
+
+    auto host = address.substr(0, n);
+    auto port = std::atoi(address.substr(n + 1).c_str());
+
+    m_lookup = lookup;
+    m_server = std::make_shared<httplib::Server>();
+    m_server->Get(R"(/.*)", [this](httplib::Request const &req, httplib::Response &res)
+    {
+        auto timer = m_serve.start();
+
+        std::string_view url = req.path;
+        cache_key key(url.substr(url.find_last_of('/') + 1));
+        auto buffer = is_valid(url, key) ? m_lookup(key) : nullptr;
+        m_serve.stop(timer, bool(buffer), buffer ? buffer->size() : 0);
+        if (!buffer)
+        {
+            res.status = httplib::StatusCode::NotFound_404;
+            return;
+        }
+
+        // Keep the buffer alive until it has been sent, without copying it
+        res.set_content_provider(buffer->size(), "application/octet-stream",
+            [buffer](size_t offset, size_t length, httplib::DataSink &sink)
+            {
+                return sink.write(buffer->data() + offset, length);
+            });
+    });
+
+    if (m_server->bind_to_port(host, port) < 0)
+    {
+        cache::log("cannot listen on {}", address);
+        m_server.reset();
+        return false;
+    }
+
+    m_thread = std::thread([this]() { m_server->listen_after_bind(); });
+    cache::log("serving local cache to peers on {}", address);
+    return true;
+}
+
+void peer_server::stop()
+{
+    if (!m_server)
+        return;
+
+    m_server->stop();
+    m_thread.join();
+    m_server.reset();
+}
+
+void peer_server::summary() const
+{
+    extern std::function<void(char const *)> g_output_func;
+    g_output_func(std::format(" - Served    : {}", m_serve.summary()).c_str());
+}
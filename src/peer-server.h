@@ -0,0 +1,66 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+#include <memory> // for std::shared_ptr
+#include <string> // for std::string
+#include <thread> // for std::thread
+#include <functional> // for std::function
+
+#include "cache-key.h"
+#include "stats.h"
+
+namespace httplib { class Server; }
+
+//
+// The peer server class
+//
+// Serves the local cache content of this agent to other agents on the LAN,
+// using the same URL layout as network caches.
+//
+
+class peer_server
+{
+public:
+    using lookup_func = std::function<std::shared_ptr<std::string>(cache_key const &)>;
+
+    ~peer_server() { stop(); }
+
+    // Start listening on a host:port address, serving entries found by a lookup function
+    bool start(std::string const &address, lookup_func lookup);
+
+    // Stop serving
+    void stop();
+
+    // Output statistics about the served entries
+    void summary() const;
+
+private:
+    std::shared_ptr<httplib::Server> m_server;
+    std::thread m_thread;
+    lookup_func m_lookup;
+
+    // Track time and bytes spent serving entries
+    stats m_serve;
+};
@@ -0,0 +1,114 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <algorithm> // for std::ranges::sort()
+#include <sstream>   // for std::stringstream
+
+#include "config.h"
+#include "digest.h"
+#include "peercache.h"
+#include "webdav-client.h"
+
+// Final mixing step of SplitMix64, to turn combined hashes into rendezvous scores
+static uint64_t mix(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+}
+
+bool peercache::init_internal(std::string const &cache_root)
+{
+    if (!cache_root.starts_with("peer://"))
+    {
+        return false;
+    }
+
+    m_peers.clear();
+    m_fanout = std::max(size_t(1), g_config.get_size("peer_fanout", 2));
+    auto timeout = std::chrono::milliseconds(g_config.get_size("peer_timeout", 200));
+
+    std::stringstream ss(cache_root.substr(7));
+    for (std::string name; std::getline(ss, name, ','); )
+    {
+        if (name.empty())
+            continue;
+
+        auto p = std::make_unique<peer>();
+        p->name = name;
+        p->hash = fnv1a(name);
+        p->client = std::make_shared<webdav_client>("http://" + name);
+        p->client->set_connection_timeout(timeout);
+        m_peers.push_back(std::move(p));
+    }
+
+    if (m_peers.empty())
+    {
+        cache::log("no peers found in {}", cache_root);
+        return false;
+    }
+
+    cache::log("initialised peer cache with {} peers", m_peers.size());
+    return true;
+}
+
+bool peercache::publish_internal(cache_key const &, std::string_view)
+{
+    return false;
+}
+
+std::shared_ptr<std::string> peercache::retrieve_internal(cache_key const &key)
+{
+    // Rank peers using rendezvous hashing, so that all agents agree on which
+    // peers are responsible for a given entry
+    auto id_hash = fnv1a(key.id());
+    std::vector<std::pair<uint64_t, peer *>> ranked;
+    for (auto &p : m_peers)
+        ranked.push_back({ mix(p->hash ^ id_hash), p.get() });
+    std::ranges::sort(ranked, std::greater<>());
+
+    auto now = std::chrono::steady_clock::now();
+    auto url = "/" + std::string(key.path());
+    size_t asked = 0;
+    for (auto [score, p] : ranked)
+    {
+        if (asked >= m_fanout)
+            break;
+        if (p->down_until.load() > now)
+            continue;
+
+        ++asked;
+        auto buffer = std::make_shared<std::string>();
+        auto res = p->client->get(url, *buffer);
+        if (!res)
+        {
+            p->down_until = now + std::chrono::seconds(30);
+            continue;
+        }
+
+        if (res->status == httplib::StatusCode::OK_200)
+            return buffer;
+    }
+
+    return nullptr;
+}
@@ -0,0 +1,72 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+#include <atomic> // for std::atomic
+#include <chrono> // for std::chrono
+#include <memory> // for std::shared_ptr
+#include <string> // for std::string
+#include <vector> // for std::vector
+
+#include "cache.h"
+
+//
+// The peer cache class
+//
+// Queries the local caches of other build agents on the LAN, as served by
+// their peer_server, before going to a remote server. This cache is read-only.
+//
+
+class peercache : public cache
+{
+public:
+    virtual bool accepts_publish() const { return false; }
+
+protected:
+    // Initialise the peer cache from a peer://host:port,host:port,... path
+    virtual bool init_internal(std::string const &cache_root);
+
+    // Peers are never published to
+    virtual bool publish_internal(cache_key const &key, std::string_view data);
+
+    // Retrieve a cache entry from the peers most likely to have it
+    virtual std::shared_ptr<std::string> retrieve_internal(cache_key const &key);
+
+private:
+    struct peer
+    {
+        std::string name;
+        uint64_t hash;
+        std::shared_ptr<class webdav_client> client;
+
+        // Peers that cannot be reached are ignored for a while
+        std::atomic<std::chrono::steady_clock::time_point> down_until;
+    };
+
+    // All known peers
+    std::vector<std::unique_ptr<peer>> m_peers;
+
+    // Number of peers to ask for each entry
+    size_t m_fanout = 0;
+};
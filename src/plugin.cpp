@@ -28,8 +28,9 @@
 #endif
 #include <CachePluginInterface.h>
 
-#include <algorithm> // for std::find_if()
+#include <algorithm> // for std::find_if(), std::ranges::any_of(), std::ranges::replace()
 #include <chrono>    // for std::chrono
+#include <future>    // for std::async()
 #include <memory>    // for std::shared_ptr
 #include <mutex>     // for std::mutex
 #include <sstream>   // for std::stringstream
@@ -38,8 +39,13 @@
 #include <vector>    // for std::vector
 
 #include "plugin.h"
+#include "config.h"
+#include "throttle.h"
+#include "trace.h"
 #include "filecache.h"
 #include "netcache.h"
+#include "peercache.h"
+#include "s3cache.h"
 
 // Global variable storing the plugin instance; the current API does not allow
 // to track a state or a closure, so this has to be global.
@@ -50,65 +56,343 @@ std::function<void(char const *)> g_output_func;
 
 bool plugin::init(std::string const &path)
 {
+    std::vector<std::future<std::shared_ptr<cache>>> pending;
+
+    m_use_admission = m_admission.init();
+    m_use_dedup = m_dedup.init();
+    trace::init();
+    throttle::init();
+
+    // The shared memory cache sits in front of all other caches
+    if (g_config.get_size("shm_size", 0))
+    {
+        m_shm = std::make_shared<shmcache>();
+        if (!m_shm->init("shm:" + g_config.get("shm_name", "fbuild-netcache")))
+            m_shm.reset();
+    }
+
+    std::vector<std::pair<std::shared_ptr<cache>, std::string>> lazy;
     std::stringstream ss(path);
     for (std::string path; std::getline(ss, path, ';'); )
     {
-        // Try to initialise a network cache, or fall back to a file cache
-        if (auto cache = std::make_shared<netcache>(); cache->init(path))
+        if (path.starts_with("lazy:"))
         {
-            m_caches.push_back(cache);
+            // Register placeholders for lazy caches right away, and replace them
+            // once the actual caches are ready
+            path = path.substr(5);
+            auto cache = new_cache(path);
+            lazy.push_back({ cache, path });
+            pending.push_back(std::async(std::launch::deferred, [cache]() { return cache; }));
         }
-        else if (auto cache = std::make_shared<filecache>(); cache->init(path))
+        else
         {
-            m_caches.push_back(cache);
+            // Initialise all other caches in parallel
+            pending.push_back(std::async(std::launch::async, &plugin::create_cache, path));
         }
     }
 
+    // Keep the caches in the order they were specified
+    auto caches = std::make_shared<cache_list>();
+    for (auto &cache : pending)
+    {
+        if (auto ret = cache.get(); ret)
+            caches->push_back(ret);
+    }
+    m_caches = caches;
+
+    for (auto const &[placeholder, path] : lazy)
+        m_lazy_init.emplace_back(&plugin::init_lazy, this, placeholder, path);
+
     // Succeed if at least one cache could be created
-    return !m_caches.empty();
+    if (caches->empty())
+        return false;
+
+    // Serve our local caches to peers if asked to
+    if (auto address = g_config.get("peer_listen"); !address.empty())
+    {
+        // Traffic from peers is only counted by the peer server
+        m_use_peer_server = m_peer_server.start(address, [this](cache_key const &key)
+        {
+            if (m_shm)
+                if (auto buffer = m_shm->peek(key); buffer)
+                    return buffer;
+            for (auto cache : *m_caches.load())
+                if (cache->ready() && cache->is_local())
+                    if (auto buffer = cache->peek(key); buffer)
+                        return buffer;
+            return std::shared_ptr<std::string>();
+        });
+    }
+
+    // Journal publishes to remote caches on disk if asked to, so that they survive
+    // network outages
+    bool has_remote = std::ranges::any_of(*caches, [](auto const &cache)
+    {
+        return !cache->is_local() && cache->accepts_publish();
+    });
+    if (auto dir = g_config.get("spool"); !dir.empty() && has_remote)
+    {
+        m_use_spool = m_spool.init(dir, [this](std::string const &id, std::string_view data)
+        {
+            // Entries that no remote cache admits are done, not failed
+            bool rejected = false;
+            if (publish_now(id, data, tiers::remote, &rejected))
+                return spool::result::uploaded;
+            return rejected ? spool::result::skipped : spool::result::failed;
+        });
+    }
+
+    return true;
+}
+
+std::shared_ptr<cache> plugin::new_cache(std::string const &path)
+{
+    std::string proto, server, port, root;
+    if (path.starts_with("peer://"))
+        return std::make_shared<peercache>();
+    if (s3cache::parse_url(path, server, root))
+        return std::make_shared<s3cache>();
+    if (netcache::parse_url(path, proto, server, port, root))
+        return std::make_shared<netcache>();
+    return std::make_shared<filecache>();
+}
+
+std::shared_ptr<cache> plugin::create_cache(std::string const &path)
+{
+    auto cache = new_cache(path);
+    if (cache->init(path))
+        return cache;
+
+    // A network cache that cannot be reached may still work as a file cache,
+    // e.g. with a UNC path on Windows
+    if (std::dynamic_pointer_cast<netcache>(cache))
+    {
+        if (auto fallback = std::make_shared<filecache>(); fallback->init(path))
+            return fallback;
+    }
+
+    return nullptr;
+}
+
+void plugin::init_lazy(std::shared_ptr<cache> placeholder, std::string path)
+{
+    // Retry with exponential backoff until the cache is ready or we shut down;
+    // this uses the same fallbacks as other caches, and only logs the first attempt
+    std::shared_ptr<cache> ready;
+    for (auto delay = std::chrono::seconds(1); !(ready = create_cache(path));
+         delay = std::min(delay * 2, std::chrono::seconds(60)))
+    {
+        if (!cache::s_quiet)
+            cache::log("will keep trying {} in the background", path);
+        cache::s_quiet = true;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_cv.wait_for(lock, delay, [this]() { return m_shutdown; }))
+            return;
+    }
+    if (cache::s_quiet)
+    {
+        cache::s_quiet = false;
+        cache::log("{} is now available", path);
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto caches = std::make_shared<cache_list>(*m_caches.load());
+    std::ranges::replace(*caches, placeholder, ready);
+    m_caches = caches;
 }
 
 void plugin::shutdown()
 {
+    if (m_use_peer_server)
+        m_peer_server.stop();
+
+    // Stop any pending lazy initialisation
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_shutdown = true;
+    }
+    m_cv.notify_all();
+    for (auto &thread : m_lazy_init)
+        thread.join();
+    m_lazy_init.clear();
+
+    // Entries that were not uploaded yet stay in the spool for the next process
+    if (m_use_spool)
+        m_spool.stop();
+
     g_output_func("--- NetCache Summary -----------------------------------------------");
     g_output_func("               Seen  Hit   Miss  Size(MiB) Avg(MiB) Spd(MiB/s)");
-    for (auto cache : m_caches)
-        cache->summary();
+    if (m_shm)
+        m_shm->summary();
+    for (auto cache : *m_caches.load())
+        if (cache->ready())
+            cache->summary();
+    if (m_use_admission)
+        m_admission.summary();
+    if (m_use_dedup)
+        m_dedup.summary();
+    throttle::summary();
+    if (m_use_spool)
+        m_spool.summary();
+    if (m_use_peer_server)
+        m_peer_server.summary();
     g_output_func("--------------------------------------------------------------------");
 
-    m_caches.clear();
+    trace::flush();
+
+    m_caches = std::make_shared<cache_list const>();
+    m_shm.reset();
 }
 
 bool plugin::publish(std::string const &id, std::string_view data)
 {
+    trace::span span("CachePublish", nullptr, id);
+
+    if (!cache_key(id).valid())
+        return false;
+
+    // Local caches get the entry right away, and remote caches get it from the
+    // spool in the background
+    if (m_use_spool)
+    {
+        bool local = publish_now(id, data, tiers::local);
+        return m_spool.append(id, data) || publish_now(id, data, tiers::remote) || local;
+    }
+
+    return publish_now(id, data);
+}
+
+bool plugin::publish_now(std::string const &id, std::string_view data, tiers which, bool *rejected)
+{
+    cache_key key(id);
+    if (!key.valid())
+        return false;
+
+    // Large payloads are stored once as blobs, and the entry only references them
+    std::string blob_id, ref;
+    if (m_use_dedup && m_dedup.wants(data))
+    {
+        blob_id = dedup::blob_id(data);
+        ref = dedup::make_ref(blob_id, data.size());
+    }
+    cache_key blob_key(blob_id);
+
     // Publish to the first cache that wants our data
-    return std::find_if(m_caches.begin(), m_caches.end(), [&](auto &cache) {
-        return cache->publish(id_to_path(id), data);
-    }) != m_caches.end();
+    bool asked = false, admitted = false;
+    auto caches = m_caches.load();
+    bool ret = std::find_if(caches->begin(), caches->end(), [&](auto &cache) {
+        if (!cache->ready() || !cache->accepts_publish()
+                             || (which == tiers::local && !cache->is_local())
+                             || (which == tiers::remote && cache->is_local()))
+            return false;
+
+        // Remote caches decide based on the full entry, since retrieving a
+        // deduplicated entry still downloads the whole blob
+        if (m_use_admission && !cache->is_local())
+        {
+            asked = true;
+            if (!m_admission.admit(*cache, data.size()))
+                return false;
+            admitted = true;
+        }
+
+        if (blob_id.empty())
+            return cache->publish(key, data);
+
+        bool known = m_dedup.is_known(cache.get(), blob_id);
+        if (!known && !cache->publish(blob_key, data))
+            return false;
+        m_dedup.set_known(cache.get(), blob_id);
+
+        if (!cache->publish(key, ref))
+            return false;
+        m_dedup.count_publish(data.size(), ref.size() + (known ? 0 : data.size()));
+        return true;
+    }) != caches->end();
+
+    // Count each entry once, whichever remote caches were asked
+    if (asked)
+        m_admission.count(data.size(), admitted);
+    if (rejected)
+        *rejected = asked && !admitted;
+    return ret;
 }
 
 bool plugin::retrieve(std::string const &id, void * &data, size_t &data_size)
 {
+    trace::span span("CacheRetrieve", nullptr, id);
+
+    cache_key key(id);
+    if (!key.valid())
+        return false;
+
+    // Entries in shared memory are already resolved
+    if (m_shm)
+    {
+        if (auto buffer = m_shm->retrieve(key); buffer)
+        {
+            data = buffer->data();
+            data_size = buffer->size();
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_resources.insert({data, buffer});
+            return true;
+        }
+    }
+
     // Try all caches until we find our data
-    for (auto cache : m_caches)
+    for (auto cache : *m_caches.load())
     {
-        if (auto buffer = cache->retrieve(id_to_path(id)); buffer)
+        if (!cache->ready())
+            continue;
+
+        if (auto buffer = resolve(cache, cache->retrieve(key)); buffer)
         {
+            // Let other processes on this machine find it too
+            if (m_shm)
+                m_shm->publish(key, *buffer);
+
             data = buffer->data();
             data_size = buffer->size();
 
             std::unique_lock<std::mutex> lock(m_mutex);
-            return m_resources.insert({data, buffer}).second;
+            m_resources.insert({data, buffer});
+            return true;
         }
     }
 
     return false;
 }
 
+std::shared_ptr<std::string> plugin::resolve(std::shared_ptr<cache> const &cache,
+                                             std::shared_ptr<std::string> buffer)
+{
+    // References are resolved even when deduplication is disabled, since other
+    // clients may have published them
+    std::string blob_id;
+    size_t size;
+    if (!buffer || !dedup::parse_ref(*buffer, blob_id, size))
+        return buffer;
+
+    // Blobs are only fetched once, then served from the local blob cache
+    if (auto blob = m_dedup.find(blob_id); blob)
+        return blob;
+
+    auto blob = cache->retrieve(cache_key(blob_id));
+    if (!blob || blob->size() != size)
+        return nullptr;
+
+    m_dedup.insert(blob_id, blob);
+    m_dedup.set_known(cache.get(), blob_id);
+    return blob;
+}
+
 void plugin::free(void *data)
 {
     std::unique_lock<std::mutex> lock(m_mutex);
-    m_resources.erase(data);
+    if (auto it = m_resources.find(data); it != m_resources.end())
+        m_resources.erase(it);
 }
 
 //
@@ -119,10 +403,11 @@ extern "C" bool CacheInitEx(const char *cachePath,
                             bool /* cacheRead */,
                             bool /* cacheWrite */,
                             bool /* cacheVerbose */,
-                            const char * /* userConfig */,
+                            const char *userConfig,
                             CacheOutputFunc outputFunc)
 {
     g_output_func = outputFunc;
+    g_config.init(userConfig ? userConfig : "");
     return g_plugin.init(cachePath);
 }
 
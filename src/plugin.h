@@ -23,11 +23,19 @@
 
 #pragma once
 
+#include <atomic> // for std::atomic
 #include <memory> // for std::shared_ptr
 #include <string> // for std::string
-#include <filesystem> // for std::filesystem::path
+#include <thread> // for std::thread
+#include <vector> // for std::vector
+#include <condition_variable> // for std::condition_variable
 
+#include "admission.h"
 #include "cache.h"
+#include "dedup.h"
+#include "peer-server.h"
+#include "shmcache.h"
+#include "spool.h"
 
 //
 // The plugin class
@@ -52,18 +60,61 @@ public:
     void free(void *data);
 
 protected:
-    // Convert a cache ID to a sharded filesystem path
-    static std::filesystem::path id_to_path(std::string const &id)
-    {
-        return std::filesystem::path(id.substr(0, 2)) / id.substr(2, 2) / id;
-    }
+    // Which caches an entry may be published to
+    enum class tiers { all, local, remote };
 
-    // All the initialised cache backends
-    std::vector<std::shared_ptr<cache>> m_caches;
+    // Publish a cache entry to the caches right away; on failure, rejected tells
+    // whether the remote caches declined the entry rather than failed to store it
+    bool publish_now(std::string const &id, std::string_view data, tiers which = tiers::all,
+                     bool *rejected = nullptr);
 
-    // Map of tracked resources
-    std::unordered_map<void *, std::shared_ptr<std::string>> m_resources;
+    // Create an uninitialised cache backend of the right type for the given path
+    static std::shared_ptr<cache> new_cache(std::string const &path);
 
-    // Protect m_resources against concurrent writes
+    // Create and initialise a cache backend for the given path
+    static std::shared_ptr<cache> create_cache(std::string const &path);
+
+    // Keep trying to create a lazy cache backend, then put it in place of its placeholder
+    void init_lazy(std::shared_ptr<cache> placeholder, std::string path);
+
+    // If a retrieved entry is a reference to a blob, return the blob instead
+    std::shared_ptr<std::string> resolve(std::shared_ptr<cache> const &cache,
+                                         std::shared_ptr<std::string> buffer);
+
+    // All the cache backends, in order; lazy ones are replaced once they are
+    // ready, so the list is only ever swapped as a whole
+    using cache_list = std::vector<std::shared_ptr<cache>>;
+    std::atomic<std::shared_ptr<cache_list const>> m_caches = std::make_shared<cache_list const>();
+
+    // Map of tracked resources; deduplicated blobs may be handed out several times
+    std::unordered_multimap<void *, std::shared_ptr<std::string>> m_resources;
+
+    // Machine-wide cache shared with other plugin instances, if enabled
+    std::shared_ptr<shmcache> m_shm;
+
+    // Skip publishing entries that are not worth caching remotely
+    admission m_admission;
+    bool m_use_admission = false;
+
+    // Deduplication of identical payloads
+    dedup m_dedup;
+    bool m_use_dedup = false;
+
+    // Journal publishes on disk and upload them in the background
+    spool m_spool;
+    bool m_use_spool = false;
+
+    // Serve local caches to peers
+    peer_server m_peer_server;
+    bool m_use_peer_server = false;
+
+    // Protect m_resources and m_caches against concurrent writes
     std::mutex m_mutex;
+
+    // Background threads initialising lazy cache backends
+    std::vector<std::thread> m_lazy_init;
+
+    // Wake up lazy initialisation threads when shutting down
+    std::condition_variable m_cv;
+    bool m_shutdown = false;
 };
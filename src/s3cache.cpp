@@ -0,0 +1,319 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <algorithm> // for std::max()
+#include <cctype>  // for std::isalnum()
+#include <chrono>  // for std::chrono
+#include <cstdlib> // for std::getenv()
+#include <format>  // for std::format()
+
+#include "config.h"
+#include "digest.h"
+#include "netcache.h"
+#include "s3cache.h"
+#include "webdav-client.h"
+
+// Payload hash telling S3 that the body is not part of the signature
+static constexpr char const *unsigned_payload = "UNSIGNED-PAYLOAD";
+
+// URI-encode a string as required by Signature Version 4
+static std::string uri_encode(std::string_view s, bool keep_slash)
+{
+    static char const digits[] = "0123456789ABCDEF";
+
+    std::string ret;
+    for (unsigned char ch : s)
+    {
+        if (std::isalnum(ch) || ch == '-' || ch == '_' || ch == '.' || ch == '~' || (keep_slash && ch == '/'))
+        {
+            ret += char(ch);
+        }
+        else
+        {
+            ret += '%';
+            ret += digits[ch >> 4];
+            ret += digits[ch & 0xf];
+        }
+    }
+    return ret;
+}
+
+// Compute a Signature Version 4 signature; headers must be sorted, with lowercase names
+static std::string signature(std::string_view secret_key, std::string_view region, std::string_view date_time,
+                             std::string_view method, std::string_view path, std::string_view query,
+                             std::vector<std::pair<std::string, std::string>> const &headers,
+                             std::string_view payload_hash, std::string &signed_headers)
+{
+    std::string canonical_headers;
+    signed_headers.clear();
+    for (auto const &[name, value] : headers)
+    {
+        canonical_headers += std::format("{}:{}\n", name, value);
+        signed_headers += (signed_headers.empty() ? "" : ";") + name;
+    }
+
+    auto date = date_time.substr(0, 8);
+    auto scope = std::format("{}/{}/s3/aws4_request", date, region);
+    auto canonical_request = std::format("{}\n{}\n{}\n{}\n{}\n{}", method, path, query,
+                                         canonical_headers, signed_headers, payload_hash);
+    auto string_to_sign = std::format("AWS4-HMAC-SHA256\n{}\n{}\n{}", date_time, scope,
+                                      sha256_hex(canonical_request));
+
+    auto key = hmac_sha256(std::format("AWS4{}", secret_key), date);
+    key = hmac_sha256(key, region);
+    key = hmac_sha256(key, "s3");
+    key = hmac_sha256(key, "aws4_request");
+    return to_hex(hmac_sha256(key, string_to_sign));
+}
+
+// Extract the text of the first given XML element from a document
+static std::string xml_value(std::string_view xml, std::string_view tag)
+{
+    auto start = xml.find(std::format("<{}>", tag));
+    auto end = xml.find(std::format("</{}>", tag));
+    if (start == std::string_view::npos || end == std::string_view::npos || end < start)
+        return {};
+    start += tag.size() + 2;
+    return std::string(xml.substr(start, end - start));
+}
+
+static httplib::Headers to_headers(std::vector<std::pair<std::string, std::string>> const &list)
+{
+    return httplib::Headers(list.begin(), list.end());
+}
+
+bool s3cache::parse_url(std::string_view url, std::string &bucket, std::string &prefix)
+{
+    if (!url.starts_with("s3://"))
+        return false;
+
+    url.remove_prefix(5);
+    auto n = url.find('/');
+    bucket = url.substr(0, n);
+    prefix = n == std::string_view::npos ? std::string_view() : url.substr(n + 1);
+    while (prefix.ends_with('/'))
+        prefix.pop_back();
+    return !bucket.empty();
+}
+
+bool s3cache::init_internal(std::string const &cache_root)
+{
+    std::string bucket, prefix;
+    if (!parse_url(cache_root, bucket, prefix))
+    {
+        cache::log("unrecognised S3 URL format {}", cache_root);
+        return false;
+    }
+
+    auto region = std::getenv("AWS_REGION");
+    m_region = g_config.get("s3_region", region && region[0] ? region : "us-east-1");
+
+    // The endpoint may be any S3-compatible server, e.g. a local MinIO instance
+    auto endpoint = g_config.get("s3_endpoint", std::format("https://s3.{}.amazonaws.com", m_region));
+    std::string proto, server, port, root;
+    if (!netcache::parse_url(endpoint, proto, server, port, root) || !proto.starts_with("http"))
+    {
+        cache::log("unrecognised S3 endpoint {}", endpoint);
+        return false;
+    }
+
+    auto access_key = std::getenv("AWS_ACCESS_KEY_ID");
+    auto secret_key = std::getenv("AWS_SECRET_ACCESS_KEY");
+    auto session_token = std::getenv("AWS_SESSION_TOKEN");
+    if (!access_key || !access_key[0] || !secret_key || !secret_key[0])
+    {
+        cache::log("no S3 credentials in AWS_ACCESS_KEY_ID and AWS_SECRET_ACCESS_KEY");
+        return false;
+    }
+    m_access_key = access_key;
+    m_secret_key = secret_key;
+    m_session_token = session_token ? session_token : "";
+
+    // Virtual-hosted addressing puts the bucket in the host name, path-style
+    // addressing puts it in the path, which local servers usually require
+    root = uri_encode(root.substr(0, root.find_last_not_of('/') + 1), true);
+    auto bucket_path = root + "/";
+    if (g_config.get_bool("s3_path_style", false))
+    {
+        m_host = server + port;
+        bucket_path = root + "/" + uri_encode(bucket, false);
+        m_root = bucket_path;
+    }
+    else
+    {
+        m_host = bucket + "." + server + port;
+        m_root = root;
+    }
+    if (!prefix.empty())
+        m_root += "/" + uri_encode(prefix, true);
+
+    m_client = std::make_shared<webdav_client>(proto + m_host);
+    m_check_size = g_config.get_size("publish_check_size", 1 << 20);
+    m_multipart_size = std::max(g_config.get_size("s3_multipart_size", 64 << 20), size_t(5) << 20);
+
+    // Check that the bucket exists and that we may access it
+    cache::log("testing connection to {}{}", proto + m_host, bucket_path);
+    auto res = m_client->head(bucket_path, to_headers(sign("HEAD", bucket_path, "")));
+    if (!res)
+    {
+        cache::log("cannot query {} ({})", cache_root, httplib::to_string(res.error()));
+        return false;
+    }
+    else if (res->status != httplib::StatusCode::OK_200)
+    {
+        cache::log("cannot access {} (Status {})", cache_root, res->status);
+        return false;
+    }
+
+    m_client->release();
+    cache::log("initialised S3 cache for {}", cache_root);
+    return true;
+}
+
+bool s3cache::publish_internal(cache_key const &key, std::string_view data)
+{
+    auto const &path = url(key);
+    if (data.size() >= m_multipart_size)
+    {
+        return put_multipart(path, data);
+    }
+
+    // Do not overwrite the entry if another client published it in the meantime
+    auto res = m_client->put(path, data.data(), data.size(), false, to_headers(sign("PUT", path, "")));
+    return res && (res->status == httplib::StatusCode::OK_200
+                    || res->status == httplib::StatusCode::PreconditionFailed_412);
+}
+
+std::string const &s3cache::url(cache_key const &key) const
+{
+    // Requests are synchronous, so each thread can reuse a single buffer, which
+    // stops allocating once it is large enough
+    static thread_local std::string buffer;
+    return buffer.assign(m_root).append(1, '/').append(key.path());
+}
+
+bool s3cache::has_entry(cache_key const &key, size_t size)
+{
+    // Only ask the bucket for entries that are expensive enough to send
+    if (!m_check_size || size < m_check_size)
+    {
+        return false;
+    }
+
+    auto const &path = url(key);
+    auto res = m_client->head(path, to_headers(sign("HEAD", path, "")));
+    return res && res->status == httplib::StatusCode::OK_200;
+}
+
+std::shared_ptr<std::string> s3cache::retrieve_internal(cache_key const &key)
+{
+    auto const &path = url(key);
+    auto buffer = std::make_shared<std::string>();
+    auto res = m_client->get(path, *buffer, to_headers(sign("GET", path, "")));
+    if (!res || res->status != httplib::StatusCode::OK_200)
+    {
+        return nullptr;
+    }
+
+    return buffer;
+}
+
+bool s3cache::put_multipart(std::string const &path, std::string_view data)
+{
+    auto res = m_client->send("POST", path + "?uploads=", to_headers(sign("POST", path, "uploads=")));
+    auto upload_id = res && res->status == httplib::StatusCode::OK_200 ? xml_value(res->body, "UploadId") : "";
+    if (upload_id.empty())
+    {
+        return false;
+    }
+
+    // Abandoned uploads keep using storage, so always complete or abort them
+    auto query = "uploadId=" + uri_encode(upload_id, false);
+    auto abort = [&]()
+    {
+        m_client->send("DELETE", path + "?" + query, to_headers(sign("DELETE", path, query)));
+    };
+
+    std::string complete = "<CompleteMultipartUpload>";
+    for (size_t offset = 0, part = 1; offset < data.size(); offset += m_multipart_size, ++part)
+    {
+        auto chunk = data.substr(offset, m_multipart_size);
+        auto part_query = std::format("partNumber={}&{}", part, query);
+        res = m_client->put(path + "?" + part_query, chunk.data(), chunk.size(), true,
+                            to_headers(sign("PUT", path, part_query)));
+        if (!res || res->status != httplib::StatusCode::OK_200 || !res->has_header("ETag"))
+        {
+            abort();
+            return false;
+        }
+
+        complete += std::format("<Part><PartNumber>{}</PartNumber><ETag>{}</ETag></Part>",
+                                part, res->get_header_value("ETag"));
+    }
+    complete += "</CompleteMultipartUpload>";
+
+    // Do not overwrite the entry if another client published it in the meantime
+    auto headers = to_headers(sign("POST", path, query));
+    headers.insert({"If-None-Match", "*"});
+    res = m_client->send("POST", path + "?" + query, headers, complete);
+
+    // Errors may also be reported in the body of a successful reply
+    if (res && res->status == httplib::StatusCode::OK_200 && res->body.find("<Error>") == std::string::npos)
+    {
+        return true;
+    }
+
+    abort();
+    return res && res->status == httplib::StatusCode::PreconditionFailed_412;
+}
+
+std::vector<std::pair<std::string, std::string>> s3cache::sign(char const *method, std::string const &path,
+                                                               std::string const &query) const
+{
+    using namespace std::chrono;
+    auto now = floor<seconds>(system_clock::now());
+    auto day = floor<days>(now);
+    year_month_day ymd(day);
+    hh_mm_ss hms(now - day);
+    auto date_time = std::format("{:04}{:02}{:02}T{:02}{:02}{:02}Z", int(ymd.year()), unsigned(ymd.month()),
+                                 unsigned(ymd.day()), hms.hours().count(), hms.minutes().count(),
+                                 hms.seconds().count());
+
+    // Signed headers, sorted by name
+    std::vector<std::pair<std::string, std::string>> headers
+    {
+        { "host", m_host },
+        { "x-amz-content-sha256", unsigned_payload },
+        { "x-amz-date", date_time },
+    };
+    if (!m_session_token.empty())
+        headers.push_back({ "x-amz-security-token", m_session_token });
+
+    std::string signed_headers;
+    auto sig = signature(m_secret_key, m_region, date_time, method, path, query, headers,
+                         unsigned_payload, signed_headers);
+    headers.push_back({ "Authorization",
+                        std::format("AWS4-HMAC-SHA256 Credential={}/{}/{}/s3/aws4_request, SignedHeaders={}, Signature={}",
+                                    m_access_key, date_time.substr(0, 8), m_region, signed_headers, sig) });
+    return headers;
+}
@@ -0,0 +1,88 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+#include <memory> // for std::shared_ptr
+#include <string> // for std::string
+#include <vector> // for std::vector
+#include <utility> // for std::pair
+#include <string_view> // for std::string_view
+
+#include "cache.h"
+
+//
+// The S3 cache class
+//
+// Stores entries as objects in an S3-compatible bucket, using requests signed
+// with AWS Signature Version 4. Object stores have no directories, so unlike
+// WebDAV, publishing an entry is a single request.
+//
+
+class s3cache : public cache
+{
+public:
+    // Split an s3://bucket/prefix path into bucket and key prefix; return false
+    // if the path does not point to a bucket
+    static bool parse_url(std::string_view url, std::string &bucket, std::string &prefix);
+
+protected:
+    // Initialise the S3 cache
+    virtual bool init_internal(std::string const &cache_root);
+
+    // Publish a cache entry
+    virtual bool publish_internal(cache_key const &key, std::string_view data);
+
+    // Retrieve a cache entry
+    virtual std::shared_ptr<std::string> retrieve_internal(cache_key const &key);
+
+    // Check whether a given entry exists in the bucket
+    virtual bool has_entry(cache_key const &key, size_t size);
+
+    // Request path of an entry; it stays valid until the next call from the same thread
+    std::string const &url(cache_key const &key) const;
+
+    // Upload a large entry in several parts
+    bool put_multipart(std::string const &path, std::string_view data);
+
+    // Authentication headers for a request; the path must already be URI-encoded
+    // and the query string in canonical order
+    std::vector<std::pair<std::string, std::string>> sign(char const *method, std::string const &path,
+                                                          std::string const &query) const;
+
+private:
+    // HTTP client for the bucket endpoint
+    std::shared_ptr<class webdav_client> m_client;
+
+    // Value of the Host header, and path to the key prefix on that host
+    std::string m_host, m_root;
+
+    // Signing information
+    std::string m_region, m_access_key, m_secret_key, m_session_token;
+
+    // Entries at least this large are checked for existence before being published
+    size_t m_check_size = 0;
+
+    // Entries at least this large are uploaded in parts of this size
+    size_t m_multipart_size = 0;
+};
@@ -0,0 +1,346 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#if _WIN32
+#   include <windows.h>  // for CreateFileMappingW(), MapViewOfFile()
+#else
+#   include <fcntl.h>    // for O_* constants
+#   include <unistd.h>   // for ftruncate(), close(), getuid()
+#   include <sys/mman.h> // for shm_open(), mmap(), munmap()
+#   include <sys/stat.h> // for fstat()
+#endif
+
+#include <algorithm> // for std::max()
+#include <atomic>  // for std::atomic
+#include <chrono>  // for std::chrono
+#include <cstring> // for std::memcpy()
+#include <format>  // for std::format()
+#include <thread>  // for std::this_thread
+
+#include "config.h"
+#include "digest.h"
+#include "shmcache.h"
+
+static constexpr uint32_t shm_magic = 0x534e4246; // "FBNS"
+static constexpr uint32_t shm_version = 1;
+
+// Consider the writer lock abandoned if it was held for that long
+static constexpr uint64_t lock_timeout_ms = 5000;
+
+// Maximum number of slots to probe for a given hash
+static constexpr size_t max_probe = 16;
+
+// Segment header; all fields after initialisation are accessed atomically
+struct shm_header
+{
+    uint32_t magic, version;
+    uint64_t slot_count, heap_size;
+
+    // 0 while uninitialised, 1 during initialisation, 2 when ready; it is only
+    // changed while holding the writer lock
+    std::atomic<uint32_t> state;
+
+    // Writer lock: zero when free, otherwise the time it was taken, in ms of the
+    // system-wide monotonic clock
+    std::atomic<uint64_t> lock;
+
+    // Position of the next write in the heap; it only grows, and entries whose
+    // position is more than heap_size behind it were overwritten
+    std::atomic<uint64_t> head;
+};
+
+// Index slot, protected by a sequence counter that is odd during updates; since
+// writers hold the lock, a writer seeing an odd counter knows its owner crashed
+struct shm_slot
+{
+    std::atomic<uint64_t> seq, hash, pos, size;
+};
+
+// Entry header in the heap, followed by the ID and the data
+struct shm_record
+{
+    uint64_t hash;
+    uint64_t id_size;
+    uint64_t data_size;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory requires lock-free atomics");
+
+// Lock timestamps are compared across processes, so they use the monotonic clock,
+// which is shared by the whole system and ignores wall clock changes
+static uint64_t now_ms()
+{
+    using namespace std::chrono;
+    return std::max(uint64_t(duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count()),
+                    uint64_t(1));
+}
+
+// Total size of a heap record, rounded up for alignment
+static uint64_t record_size(size_t id_size, size_t data_size)
+{
+    return (sizeof(shm_record) + id_size + data_size + 7) & ~uint64_t(7);
+}
+
+shmcache::~shmcache()
+{
+    if (!m_data)
+        return;
+
+#if _WIN32
+    UnmapViewOfFile(m_data);
+#else
+    munmap(m_data, m_size);
+#endif
+}
+
+bool shmcache::init_internal(std::string const &cache_root)
+{
+    auto name = cache_root.substr(cache_root.find(':') + 1);
+    auto size = g_config.get_size("shm_size", 0);
+    if (size < (1 << 20))
+    {
+        cache::log("shared memory cache size must be at least 1 MiB");
+        return false;
+    }
+
+#if _WIN32
+    auto wname = L"Local\\" + std::wstring(name.begin(), name.end());
+    HANDLE mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                        DWORD(uint64_t(size) >> 32), DWORD(size), wname.c_str());
+    if (!mapping)
+    {
+        cache::log("cannot create shared memory segment {}", name);
+        return false;
+    }
+
+    // If the segment already existed, its size may differ from ours
+    m_data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    CloseHandle(mapping);
+    MEMORY_BASIC_INFORMATION info;
+    if (!m_data || !VirtualQuery(m_data, &info, sizeof(info)))
+    {
+        cache::log("cannot map shared memory segment {}", name);
+        return false;
+    }
+    m_size = info.RegionSize;
+#else
+    // Segments are per user, so that different users never share entries
+    auto shm_name = std::format("/{}-{}", name, getuid());
+    int fd = shm_open(shm_name.c_str(), O_RDWR | O_CREAT, 0600);
+    if (fd < 0)
+    {
+        cache::log("cannot create shared memory segment {}", shm_name);
+        return false;
+    }
+
+    // If the segment already existed, keep its size
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (st.st_size == 0 && ftruncate(fd, off_t(size)) != 0))
+    {
+        cache::log("cannot resize shared memory segment {}", shm_name);
+        close(fd);
+        return false;
+    }
+
+    m_size = st.st_size ? size_t(st.st_size) : size;
+    m_data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m_data == MAP_FAILED)
+    {
+        m_data = nullptr;
+        cache::log("cannot map shared memory segment {}", shm_name);
+        return false;
+    }
+#endif
+
+    // New segments are zero-filled; the first process to take the lock lays them
+    // out. If that process crashed, its lock expires and another one does it.
+    m_header = static_cast<shm_header *>(m_data);
+    for (uint64_t i = 0; i < lock_timeout_ms + 1000 && m_header->state != 2; ++i)
+    {
+        if (try_lock())
+        {
+            if (m_header->state != 2)
+            {
+                m_header->state = 1;
+                m_header->magic = shm_magic;
+                m_header->version = shm_version;
+
+                // Use about one index slot per 8 KiB of heap
+                m_header->slot_count = 1024;
+                while (m_header->slot_count * 8192 < m_size)
+                    m_header->slot_count *= 2;
+                auto heap_offset = sizeof(shm_header) + m_header->slot_count * sizeof(shm_slot);
+                m_header->heap_size = (m_size - heap_offset) & ~uint64_t(7);
+                m_header->state = 2;
+            }
+            unlock();
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    if (m_header->state != 2 || m_header->magic != shm_magic || m_header->version != shm_version
+         || sizeof(shm_header) + m_header->slot_count * sizeof(shm_slot) + m_header->heap_size > m_size)
+    {
+        cache::log("incompatible shared memory segment {}", name);
+        return false;
+    }
+
+    m_slots = reinterpret_cast<shm_slot *>(static_cast<char *>(m_data) + sizeof(shm_header));
+    m_heap = reinterpret_cast<char *>(m_slots + m_header->slot_count);
+
+    cache::log("attached to shared memory cache {} ({} MiB)", name, m_size >> 20);
+    return true;
+}
+
+bool shmcache::publish_internal(cache_key const &key, std::string_view data)
+{
+    auto id = key.id();
+    auto hash = fnv1a(id) | 1; // zero means an empty slot
+    auto total = record_size(id.size(), data.size());
+    auto heap_size = m_header->heap_size;
+
+    // Do not let a single entry evict a large part of the cache
+    if (total > heap_size / 8 || !lock())
+    {
+        return false;
+    }
+
+    // Reserve space at the head of the heap, without wrapping records around
+    auto pos = m_header->head.load(std::memory_order_relaxed);
+    if (pos % heap_size + total > heap_size)
+        pos += heap_size - pos % heap_size;
+
+    // Publish the new head before overwriting old records, so that readers
+    // copying them can notice
+    m_header->head.store(pos + total, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    shm_record r { hash, id.size(), data.size() };
+    auto dst = m_heap + pos % heap_size;
+    std::memcpy(dst, &r, sizeof(r));
+    std::memcpy(dst + sizeof(r), id.data(), id.size());
+    std::memcpy(dst + sizeof(r) + id.size(), data.data(), data.size());
+
+    // Pick an empty, overwritten, or matching slot, or else the oldest one
+    auto mask = m_header->slot_count - 1;
+    shm_slot *target = nullptr;
+    for (size_t n = 0; n < max_probe; ++n)
+    {
+        auto &s = m_slots[(hash + n) & mask];
+        auto s_hash = s.hash.load(std::memory_order_relaxed);
+        auto s_pos = s.pos.load(std::memory_order_relaxed);
+        auto s_seq = s.seq.load(std::memory_order_relaxed);
+        if (!s_hash || s_hash == hash || (s_seq & 1) || s_pos + heap_size < pos + total)
+        {
+            target = &s;
+            break;
+        }
+        if (!target || s_pos < target->pos.load(std::memory_order_relaxed))
+            target = &s;
+    }
+
+    // Make the counter odd, unless a crashed writer already left it so
+    auto seq = target->seq.load(std::memory_order_relaxed) | 1;
+    target->seq.store(seq, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    target->hash.store(hash, std::memory_order_relaxed);
+    target->pos.store(pos, std::memory_order_relaxed);
+    target->size.store(total, std::memory_order_relaxed);
+    target->seq.store(seq + 1, std::memory_order_release);
+
+    unlock();
+    return true;
+}
+
+std::shared_ptr<std::string> shmcache::retrieve_internal(cache_key const &key)
+{
+    auto id = key.id();
+    auto hash = fnv1a(id) | 1;
+    auto heap_size = m_header->heap_size;
+    auto mask = m_header->slot_count - 1;
+
+    for (size_t n = 0; n < max_probe; ++n)
+    {
+        // Read a consistent copy of the slot
+        auto &s = m_slots[(hash + n) & mask];
+        auto seq = s.seq.load(std::memory_order_acquire);
+        auto s_hash = s.hash.load(std::memory_order_relaxed);
+        auto pos = s.pos.load(std::memory_order_relaxed);
+        auto total = s.size.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if ((seq & 1) || seq != s.seq.load(std::memory_order_relaxed))
+            continue;
+
+        if (!s_hash)
+            break;
+        if (s_hash != hash || total < sizeof(shm_record) || total > heap_size
+             || pos + heap_size < m_header->head.load(std::memory_order_acquire))
+            continue;
+
+        // Copy the record, then check that it was not overwritten in the meantime;
+        // this is the classic seqlock pattern, using the heap head as the counter
+        auto src = m_heap + pos % heap_size;
+        shm_record r;
+        std::memcpy(&r, src, sizeof(r));
+        if (r.hash != hash || r.id_size != id.size() || record_size(r.id_size, r.data_size) != total
+             || std::memcmp(src + sizeof(r), id.data(), id.size()) != 0)
+            continue;
+
+        auto buffer = std::make_shared<std::string>(src + sizeof(r) + r.id_size, r.data_size);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (pos + heap_size < m_header->head.load(std::memory_order_relaxed))
+            return nullptr;
+
+        return buffer;
+    }
+
+    return nullptr;
+}
+
+bool shmcache::try_lock()
+{
+    auto now = now_ms();
+    auto held = m_header->lock.load(std::memory_order_relaxed);
+    return (!held || now > held + lock_timeout_ms)
+            && m_header->lock.compare_exchange_strong(held, now, std::memory_order_acquire);
+}
+
+bool shmcache::lock()
+{
+    // Give up quickly, since publishing to this cache is only an optimisation
+    for (int i = 0; i < 100; ++i)
+    {
+        if (try_lock())
+            return true;
+        std::this_thread::yield();
+    }
+
+    return false;
+}
+
+void shmcache::unlock()
+{
+    m_header->lock.store(0, std::memory_order_release);
+}
@@ -0,0 +1,74 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+#include <memory> // for std::shared_ptr
+#include <string> // for std::string
+#include <string_view> // for std::string_view
+
+#include "cache.h"
+
+//
+// The shared memory cache class
+//
+// A fixed-size cache in a named shared memory segment, shared by all plugin
+// instances on the machine. Entries are appended to a circular heap, where
+// new entries overwrite the oldest ones, and are found through an open
+// addressing index. Readers never take locks: they validate what they copied
+// against sequence counters and the heap write position.
+//
+
+class shmcache : public cache
+{
+public:
+    virtual ~shmcache();
+
+    // Shared memory is local to this machine
+    virtual bool is_local() const { return true; }
+
+protected:
+    // Attach to the shared memory segment, creating it if necessary
+    virtual bool init_internal(std::string const &cache_root);
+
+    // Copy an entry into shared memory
+    virtual bool publish_internal(cache_key const &key, std::string_view data);
+
+    // Copy an entry out of shared memory
+    virtual std::shared_ptr<std::string> retrieve_internal(cache_key const &key);
+
+    // Take the writer lock, stealing it from crashed processes
+    bool try_lock();
+    bool lock();
+    void unlock();
+
+private:
+    // Mapped segment
+    void *m_data = nullptr;
+    size_t m_size = 0;
+
+    // Layout of the segment
+    struct shm_header *m_header = nullptr;
+    struct shm_slot *m_slots = nullptr;
+    char *m_heap = nullptr;
+};
@@ -0,0 +1,316 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <algorithm> // for std::ranges::sort()
+#include <chrono>    // for std::chrono
+#include <cstring>   // for std::memcpy()
+#include <format>    // for std::format()
+#include <fstream>   // for std::ifstream
+#include <random>    // for std::random_device
+#include <vector>    // for std::vector
+
+#include "cache.h"
+#include "digest.h"
+#include "spool.h"
+
+// Record header in a segment, followed by the ID and the data
+struct spool_record
+{
+    uint32_t magic;
+    uint32_t id_size;
+    uint64_t data_size;
+    uint64_t checksum;
+};
+
+static constexpr uint32_t record_magic = 0x514e4246; // "FBNQ"
+
+// Start a new segment once the current one is this large, so that it can be deleted
+static constexpr size_t max_segment_size = size_t(256) << 20;
+
+// Give up on an entry that keeps failing while the following ones succeed
+static constexpr int max_failures = 10;
+
+static uint64_t checksum(std::string_view id, std::string_view data)
+{
+    return fnv1a(id) ^ fnv1a(data);
+}
+
+// Parse the record at a given offset; fails on incomplete or corrupted records
+static bool parse_record(mapped_file const &file, uint64_t offset, std::string_view &id,
+                         std::string_view &data, uint64_t &next)
+{
+    spool_record r;
+    if (file.size() < offset + sizeof(r))
+        return false;
+
+    std::memcpy(&r, file.data() + offset, sizeof(r));
+    auto left = file.size() - offset - sizeof(r);
+    if (r.magic != record_magic || r.id_size > left || r.data_size > left - r.id_size)
+        return false;
+
+    id = std::string_view(file.data() + offset + sizeof(r), r.id_size);
+    data = std::string_view(id.data() + id.size(), r.data_size);
+    next = offset + sizeof(r) + r.id_size + r.data_size;
+    return checksum(id, data) == r.checksum;
+}
+
+// Read the offset up to which a segment was uploaded
+static uint64_t read_ack(std::filesystem::path const &path)
+{
+    uint64_t offset = 0;
+    std::ifstream file(path);
+    return file >> offset ? offset : 0;
+}
+
+// Atomically replace the offset up to which a segment was uploaded; it is synced
+// to disk, so that a crash does not cause entries to be uploaded again
+static void write_ack(std::filesystem::path const &path, uint64_t offset)
+{
+    durable_write(path, std::to_string(offset));
+}
+
+bool spool::init(std::string const &dir, upload_func upload)
+{
+    std::error_code ec;
+    m_dir = std::filesystem::path(dir);
+    std::filesystem::create_directories(m_dir, ec);
+    if (ec.value() != 0)
+    {
+        cache::log("cannot use spool directory {}", dir);
+        return false;
+    }
+
+    open_segment();
+    m_upload = upload;
+    m_thread = std::thread(&spool::run, this);
+    cache::log("spooling publishes to {}", dir);
+    return true;
+}
+
+void spool::stop()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_shutdown = true;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+
+    // Releasing the locks lets the next process take over our segments
+    m_segment_lock.reset();
+    m_upload_lock.reset();
+}
+
+bool spool::stopping()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_shutdown;
+}
+
+void spool::open_segment()
+{
+    // Segment names sort by creation time
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    auto name = std::format("{:016x}-{:08x}", std::chrono::duration_cast<std::chrono::milliseconds>(now).count(),
+                            std::random_device()());
+
+    // The lock is only created with the first record, so that processes that
+    // never publish do not leave lock files behind
+    m_segment = m_dir / (name + ".spool");
+    m_segment_lock.reset();
+    m_segment_size = 0;
+}
+
+bool spool::append(std::string const &id, std::string_view data)
+{
+    spool_record r { record_magic, uint32_t(id.size()), data.size(), checksum(id, data) };
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_segment_size >= max_segment_size)
+            open_segment();
+
+        if (!m_segment_lock)
+        {
+            auto segment_lock = std::make_unique<file_lock>(std::filesystem::path(m_segment).replace_extension(".lock"));
+            if (!segment_lock->locked())
+                return false;
+            m_segment_lock = std::move(segment_lock);
+        }
+
+        // A failed write may leave a torn record behind; the uploader stops there,
+        // so later records must go to a new segment
+        if (!locked_append(m_segment, { std::string_view(reinterpret_cast<char const *>(&r), sizeof(r)), id, data }))
+        {
+            open_segment();
+            return false;
+        }
+
+        m_segment_size += sizeof(r) + id.size() + data.size();
+        m_pending = true;
+    }
+    m_cv.notify_one();
+
+    ++m_queued;
+    m_queued_bytes += data.size();
+    return true;
+}
+
+void spool::run()
+{
+    auto delay = std::chrono::seconds(1);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_shutdown)
+    {
+        m_pending = false;
+        lock.unlock();
+        bool ok = process();
+        lock.lock();
+
+        // Retry failed uploads with exponential backoff; otherwise, upload new
+        // entries right away, and check for segments from other processes
+        delay = ok ? std::chrono::seconds(1) : std::min(delay * 2, std::chrono::seconds(60));
+        m_cv.wait_for(lock, delay, [&]() { return m_shutdown || (ok && m_pending); });
+    }
+}
+
+bool spool::process()
+{
+    if (!m_upload_lock || !m_upload_lock->locked())
+    {
+        m_upload_lock = std::make_unique<file_lock>(m_dir / "upload.lock");
+        if (!m_upload_lock->locked())
+            return true;
+    }
+
+    std::error_code ec;
+    std::vector<std::filesystem::path> segments, locks;
+    for (auto const &entry : std::filesystem::directory_iterator(m_dir, ec))
+        if (entry.path().extension() == ".spool")
+            segments.push_back(entry.path());
+        else if (entry.path().extension() == ".lock" && entry.path().filename() != "upload.lock")
+            locks.push_back(entry.path());
+    std::ranges::sort(segments);
+
+    // Remove lock files whose owner died before writing its segment
+    for (auto const &lock : locks)
+        if (!std::filesystem::exists(std::filesystem::path(lock).replace_extension(".spool"), ec)
+             && file_lock(lock).locked())
+            std::filesystem::remove(lock, ec);
+
+    for (auto const &segment : segments)
+    {
+        if (stopping())
+            break;
+
+        // Segments are complete once their writer released its lock
+        bool closed;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            closed = segment != m_segment
+                      && file_lock(std::filesystem::path(segment).replace_extension(".lock")).locked();
+        }
+
+        if (!process_segment(segment, closed))
+            return false;
+    }
+
+    return true;
+}
+
+bool spool::process_segment(std::filesystem::path const &segment, bool closed)
+{
+    auto ack = std::filesystem::path(segment).replace_extension(".ack");
+    auto offset = read_ack(ack);
+
+    bool ok = true;
+    uint64_t size;
+    {
+        mapped_file file(segment);
+        size = file.size();
+        for (uint64_t next; offset < file.size(); offset = next)
+        {
+            // When shutting down, leave the remaining entries to the next process
+            if (stopping())
+                break;
+
+            // An invalid record is either still being written, or was torn by a crash
+            std::string_view id, data;
+            if (!parse_record(file, offset, id, data, next))
+            {
+                if (closed)
+                    offset = size;
+                break;
+            }
+
+            if (auto ret = m_upload(std::string(id), data); ret != result::failed)
+            {
+                ++(ret == result::uploaded ? m_uploaded : m_skipped);
+                m_failures = 0;
+                write_ack(ack, next);
+                continue;
+            }
+
+            // An entry that keeps failing while the next one uploads fine will never succeed
+            std::string_view next_id, next_data;
+            uint64_t after;
+            auto ret = result::failed;
+            if (++m_failures >= max_failures && parse_record(file, next, next_id, next_data, after)
+                 && (ret = m_upload(std::string(next_id), next_data)) != result::failed)
+            {
+                ++(ret == result::uploaded ? m_uploaded : m_skipped);
+                ++m_dropped;
+                m_failures = 0;
+                write_ack(ack, after);
+                next = after;
+                continue;
+            }
+
+            ok = false;
+            break;
+        }
+    }
+
+    if (closed && ok && offset >= size)
+    {
+        std::error_code ec;
+        std::filesystem::remove(segment, ec);
+        std::filesystem::remove(ack, ec);
+        std::filesystem::remove(std::filesystem::path(segment).replace_extension(".lock"), ec);
+    }
+
+    return ok;
+}
+
+void spool::summary() const
+{
+    if (!m_queued && !m_uploaded && !m_skipped)
+        return;
+
+    extern std::function<void(char const *)> g_output_func;
+    g_output_func(std::format(" - Spool     : {} queued ({:.2f} MiB), {} uploaded, {} skipped, {} dropped",
+                              m_queued.load(), m_queued_bytes / 1048576.0, m_uploaded.load(),
+                              m_skipped.load(), m_dropped.load()).c_str());
+}
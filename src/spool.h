@@ -0,0 +1,105 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+#include <atomic> // for std::atomic
+#include <memory> // for std::unique_ptr
+#include <mutex>  // for std::mutex
+#include <string> // for std::string
+#include <thread> // for std::thread
+#include <filesystem> // for std::filesystem::path
+#include <functional> // for std::function
+#include <string_view> // for std::string_view
+#include <condition_variable> // for std::condition_variable
+
+#include "file-utils.h"
+
+//
+// The publish spool class
+//
+// Publishes are journaled to segment files in a local directory and return
+// immediately; a background thread uploads them, retrying until it succeeds.
+// Each process appends to its own segments, and whichever process holds the
+// upload lock replays all of them, including those left by earlier processes.
+//
+
+class spool
+{
+public:
+    // Outcome of an upload; skipped entries, e.g. rejected by policy, are not retried
+    enum class result { uploaded, skipped, failed };
+
+    using upload_func = std::function<result(std::string const &id, std::string_view data)>;
+
+    ~spool() { stop(); }
+
+    // Start journaling to a directory, and uploading entries using a given function
+    bool init(std::string const &dir, upload_func upload);
+
+    // Stop uploading; pending entries stay on disk for the next process
+    void stop();
+
+    // Journal a cache entry for upload
+    bool append(std::string const &id, std::string_view data);
+
+    // Output statistics about the spool
+    void summary() const;
+
+private:
+    // Start a new segment for this process
+    void open_segment();
+
+    // Whether stop() was called
+    bool stopping();
+
+    // Background upload thread
+    void run();
+
+    // Upload pending entries from all segments; return false if uploads failed
+    bool process();
+
+    // Upload pending entries from a segment; closed segments are deleted when done
+    bool process_segment(std::filesystem::path const &segment, bool closed);
+
+    std::filesystem::path m_dir;
+    upload_func m_upload;
+
+    // Segment this process appends to, and the lock showing it is still in use
+    std::filesystem::path m_segment;
+    std::unique_ptr<file_lock> m_segment_lock;
+    size_t m_segment_size = 0;
+
+    // Only one process uploads at a time
+    std::unique_ptr<file_lock> m_upload_lock;
+
+    // Consecutive upload failures of the oldest pending entry
+    int m_failures = 0;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_shutdown = false, m_pending = false;
+
+    std::atomic<size_t> m_queued = 0, m_queued_bytes = 0, m_uploaded = 0, m_skipped = 0, m_dropped = 0;
+};
@@ -23,6 +23,7 @@
 
 #pragma once
 
+#include <atomic> // for std::atomic
 #include <chrono> // for std::chrono
 #include <format> // for std::format
 #include <memory> // for std::shared_ptr
@@ -40,6 +41,8 @@ public:
     class token : private std::chrono::duration<float>
     {
         friend class stats;
+
+        std::chrono::high_resolution_clock::time_point m_start = std::chrono::high_resolution_clock::now();
     };
 
     // Start tracking time
@@ -63,9 +66,31 @@ public:
         {
             m_hits += 1;
             m_bytes += bytes;
+            measure(std::chrono::duration<float>(m_last_sync - t->m_start).count(), bytes);
         }
     }
 
+    // Recent average duration of small successful operations, in seconds, or zero if unknown
+    float latency() const { return m_latency; }
+
+    // Recent average transfer rate of large successful operations, in bytes per second,
+    // or zero if unknown
+    float bandwidth() const { return m_bandwidth; }
+
+    // Stop tracking time for data that was handled without having to be transferred
+    void skip(std::shared_ptr<token> t, size_t bytes)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        sync();
+        m_tokens.erase(t);
+
+        m_time += *t;
+        m_skipped += 1;
+        m_skipped_bytes += bytes;
+    }
+
+    size_t skipped() const { return m_skipped; }
+
     std::string summary() const
     {
         return std::format("{: <5} {: <5} {: <5} {:9.2f}  {:7.2f}  {:9.2f}",
@@ -74,6 +99,13 @@ public:
                            m_time.count() ? m_bytes / float(1 << 20) / m_time.count() : 0.0f);
     }
 
+    std::string skip_summary() const
+    {
+        return std::format("{: <5} {: <5} {: <5} {:9.2f}  {:7.2f}",
+                           m_skipped, m_skipped, 0, m_skipped_bytes / float(1 << 20),
+                           m_skipped ? m_skipped_bytes / float(1 << 20) / m_skipped : 0.0f);
+    }
+
 protected:
     // Create a synchronisation point for all time tracking tokens, dividing
     // the elapsed time by the number of concurrent timers. This will give us
@@ -88,6 +120,21 @@ protected:
         m_last_sync = now;
     }
 
+    // Update the latency and bandwidth estimates with a single operation; small
+    // transfers are dominated by latency, large ones by bandwidth
+    void measure(float seconds, size_t bytes)
+    {
+        auto average = [](std::atomic<float> &value, float sample)
+        {
+            value = value ? value * 0.9f + sample * 0.1f : sample;
+        };
+
+        if (bytes < (64 << 10))
+            average(m_latency, seconds);
+        else if (auto transfer = seconds - m_latency; transfer > 0)
+            average(m_bandwidth, bytes / transfer);
+    }
+
 private:
     // Time of the last token creation or deletion
     std::chrono::high_resolution_clock::time_point m_last_sync;
@@ -101,6 +148,12 @@ private:
     // Number of seen, hits, and total bytes
     size_t m_seen, m_hits, m_bytes;
 
+    // Number of skipped transfers, and total bytes that were not transferred
+    size_t m_skipped = 0, m_skipped_bytes = 0;
+
+    // Moving averages of recent operations
+    std::atomic<float> m_latency = 0, m_bandwidth = 0;
+
     // Protect stats against concurrent writes
     std::mutex m_mutex;
 };
@@ -0,0 +1,159 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <algorithm> // for std::min()
+#include <chrono>    // for std::chrono
+#include <format>    // for std::format()
+#include <functional> // for std::function
+#include <mutex>     // for std::mutex
+#include <thread>    // for std::this_thread
+#include <condition_variable> // for std::condition_variable
+
+#include "config.h"
+#include "throttle.h"
+
+using clock_type = std::chrono::steady_clock;
+
+// Settings: publish rate in bytes per second, maximum number of concurrent
+// publishes, and whether publishes yield to retrieves
+static double g_rate = 0.0;
+static size_t g_connections = 0;
+static bool g_yield = false;
+
+// Never make a publish wait longer than this for retrieves, so that it still
+// makes progress even when retrieves never stop
+static auto const g_max_yield = std::chrono::milliseconds(50);
+
+// Token bucket state; tokens may become negative, meaning that callers have to
+// wait for the debt to be repaid
+static double g_tokens = 0.0;
+static clock_type::time_point g_last_refill;
+
+// Number of running retrieves and publishes
+static size_t g_retrieves = 0, g_publishes = 0;
+
+// Statistics
+static std::chrono::duration<float> g_throttled { 0 };
+static size_t g_throttled_count = 0;
+
+static std::mutex g_mutex;
+static std::condition_variable g_cv;
+
+throttle::retrieve_guard::retrieve_guard()
+{
+    std::unique_lock<std::mutex> lock(g_mutex);
+    ++g_retrieves;
+}
+
+throttle::retrieve_guard::~retrieve_guard()
+{
+    std::unique_lock<std::mutex> lock(g_mutex);
+    if (--g_retrieves == 0)
+        g_cv.notify_all();
+}
+
+throttle::publish_guard::publish_guard()
+{
+    if (!g_connections)
+        return;
+
+    auto start = clock_type::now();
+    std::unique_lock<std::mutex> lock(g_mutex);
+    g_cv.wait(lock, []() { return g_publishes < g_connections; });
+    ++g_publishes;
+
+    // Count waits like those for tokens in acquire()
+    if (auto elapsed = clock_type::now() - start; elapsed > std::chrono::milliseconds(1))
+    {
+        g_throttled += elapsed;
+        g_throttled_count += 1;
+    }
+}
+
+throttle::publish_guard::~publish_guard()
+{
+    if (!g_connections)
+        return;
+
+    std::unique_lock<std::mutex> lock(g_mutex);
+    --g_publishes;
+    g_cv.notify_all();
+}
+
+void throttle::init()
+{
+    g_rate = double(g_config.get_size("publish_rate", 0));
+    g_connections = g_config.get_size("publish_connections", 0);
+    g_yield = g_config.get_bool("publish_yield", false);
+
+    // Allow bursts of a quarter of a second worth of data
+    g_tokens = g_rate / 4;
+    g_last_refill = clock_type::now();
+}
+
+bool throttle::enabled()
+{
+    return g_rate > 0 || g_yield;
+}
+
+void throttle::acquire(size_t bytes)
+{
+    auto start = clock_type::now();
+    std::unique_lock<std::mutex> lock(g_mutex);
+
+    // Let running retrieves go first
+    if (g_yield)
+        g_cv.wait_for(lock, g_max_yield, []() { return g_retrieves == 0; });
+
+    // Take the tokens we need, then wait until the bucket is no longer in debt
+    auto wait = clock_type::duration::zero();
+    if (g_rate > 0)
+    {
+        auto now = clock_type::now();
+        g_tokens = std::min(g_rate / 4, g_tokens + std::chrono::duration<double>(now - g_last_refill).count() * g_rate);
+        g_last_refill = now;
+        g_tokens -= double(bytes);
+        if (g_tokens < 0)
+            wait = std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(-g_tokens / g_rate));
+    }
+
+    lock.unlock();
+    std::this_thread::sleep_for(wait);
+
+    if (auto elapsed = clock_type::now() - start; elapsed > std::chrono::milliseconds(1))
+    {
+        lock.lock();
+        g_throttled += elapsed;
+        g_throttled_count += 1;
+    }
+}
+
+void throttle::summary()
+{
+    extern std::function<void(char const *)> g_output_func;
+
+    std::unique_lock<std::mutex> lock(g_mutex);
+    if (g_rate > 0 || g_yield || g_connections)
+        g_output_func(std::format(" - Throttle  : {:.2f} s spent waiting, {} waits",
+                                  g_throttled.count(), g_throttled_count).c_str());
+}
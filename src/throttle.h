@@ -0,0 +1,66 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+#include <cstddef> // for size_t
+
+//
+// The upload throttling class
+//
+// Publish traffic to all network caches shares the same uplink, so it goes
+// through a single token bucket limiting its rate. Publishes also yield to
+// retrieves, which builds are actually waiting for.
+//
+
+class throttle
+{
+public:
+    // Track a retrieve for its whole duration; publishes pause while any is running
+    class retrieve_guard
+    {
+    public:
+        retrieve_guard();
+        ~retrieve_guard();
+    };
+
+    // Hold one of the limited publish connections for the whole duration of a publish
+    class publish_guard
+    {
+    public:
+        publish_guard();
+        ~publish_guard();
+    };
+
+    // Configure throttling from the plugin settings
+    static void init();
+
+    // Whether publish traffic is throttled at all
+    static bool enabled();
+
+    // Wait until a given amount of publish data may be sent
+    static void acquire(size_t bytes);
+
+    // Output statistics about throttling
+    static void summary();
+};
@@ -0,0 +1,194 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#if _WIN32
+#   include <process.h> // for _getpid()
+#   define getpid _getpid
+#else
+#   include <unistd.h>  // for getpid()
+#endif
+
+#include <algorithm> // for std::min()
+#include <cstring> // for std::memcpy()
+#include <format>  // for std::format()
+#include <fstream> // for std::ofstream
+#include <memory>  // for std::shared_ptr
+#include <mutex>   // for std::mutex
+#include <vector>  // for std::vector
+
+#include "cache.h"
+#include "config.h"
+#include "trace.h"
+
+// A ring buffer of spans recorded by a given thread; its lock is only contended
+// while the buffer is being flushed
+struct trace_buffer
+{
+    std::vector<trace::event> events;
+    size_t count = 0;
+    size_t tid = 0;
+    std::mutex mutex;
+};
+
+static std::string g_trace_path;
+static size_t g_trace_events = 0;
+static std::chrono::steady_clock::time_point g_trace_start;
+
+// All thread buffers, kept alive until shutdown even if their thread exits
+static std::vector<std::shared_ptr<trace_buffer>> g_trace_buffers;
+static std::mutex g_trace_mutex;
+
+// Copy a string into a fixed-size buffer, truncating it if necessary
+template<size_t N>
+static void copy(char (&dst)[N], std::string_view src)
+{
+    auto len = std::min(src.size(), N - 1);
+    std::memcpy(dst, src.data(), len);
+    dst[len] = '\0';
+}
+
+// Escape a string for use in JSON
+static std::string escape(char const *s)
+{
+    std::string ret;
+    for (; s && *s; ++s)
+    {
+        if (*s == '"' || *s == '\\')
+            ret += '\\';
+        ret += *s;
+    }
+    return ret;
+}
+
+trace::span::span(char const *name, char const *backend, std::string_view id)
+{
+    if (!trace::enabled())
+        return;
+
+    m_event.name = name;
+    copy(m_event.backend, backend ? backend : "");
+    copy(m_event.id, id);
+    m_event.start = std::chrono::steady_clock::now();
+    m_active = true;
+}
+
+void trace::span::stop()
+{
+    if (!m_active)
+        return;
+
+    m_active = false;
+    if (!trace::enabled())
+        return;
+
+    m_event.end = std::chrono::steady_clock::now();
+    trace::record(m_event);
+}
+
+void trace::init()
+{
+    g_trace_path = g_config.get("trace");
+    g_trace_events = g_config.get_size("trace_events", 16384);
+    g_trace_start = std::chrono::steady_clock::now();
+    s_enabled = !g_trace_path.empty() && g_trace_events;
+}
+
+void trace::record(char const *name, char const *backend, std::string_view id,
+                   std::chrono::steady_clock::time_point start,
+                   std::chrono::steady_clock::time_point end)
+{
+    if (!trace::enabled())
+        return;
+
+    span s(name, backend, id);
+    s.m_event.start = start;
+    s.m_event.end = end;
+    record(s.m_event);
+    s.m_active = false;
+}
+
+void trace::record(event const &e)
+{
+    static thread_local std::shared_ptr<trace_buffer> buffer;
+
+    if (!trace::enabled())
+        return;
+
+    // Register a new buffer the first time this thread records a span
+    if (!buffer)
+    {
+        buffer = std::make_shared<trace_buffer>();
+        buffer->events.resize(g_trace_events);
+
+        std::unique_lock<std::mutex> lock(g_trace_mutex);
+        buffer->tid = g_trace_buffers.size() + 1;
+        g_trace_buffers.push_back(buffer);
+    }
+
+    // Overwrite the oldest spans when the buffer is full
+    std::unique_lock<std::mutex> lock(buffer->mutex);
+    buffer->events[buffer->count++ % buffer->events.size()] = e;
+}
+
+void trace::flush()
+{
+    if (!s_enabled)
+        return;
+
+    s_enabled = false;
+
+    std::ofstream file(g_trace_path, std::ios::out | std::ios::trunc);
+    if (!file)
+    {
+        cache::log("cannot write trace file {}", g_trace_path);
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(g_trace_mutex);
+    auto us = [](auto t) { return std::chrono::duration<double, std::micro>(t).count(); };
+    auto pid = getpid();
+
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    file << std::format("{{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":{},\"args\":{{\"name\":\"NetCache\"}}}}", pid);
+    for (auto const &buffer : g_trace_buffers)
+    {
+        // Threads that are still running may be recording a last span
+        std::unique_lock<std::mutex> buffer_lock(buffer->mutex);
+        file << std::format(",\n{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":{},\"tid\":{},"
+                            "\"args\":{{\"name\":\"NetCache thread {}\"}}}}", pid, buffer->tid, buffer->tid);
+
+        auto first = buffer->count > buffer->events.size() ? buffer->count - buffer->events.size() : 0;
+        for (auto i = first; i < buffer->count; ++i)
+        {
+            auto const &e = buffer->events[i % buffer->events.size()];
+            file << std::format(",\n{{\"name\":\"{}\",\"cat\":\"netcache\",\"ph\":\"X\",\"ts\":{:.3f},\"dur\":{:.3f},"
+                                "\"pid\":{},\"tid\":{},\"args\":{{\"backend\":\"{}\",\"id\":\"{}\"}}}}",
+                                e.name, us(e.start - g_trace_start), us(e.end - e.start),
+                                pid, buffer->tid, escape(e.backend), escape(e.id));
+        }
+    }
+    file << "\n]}\n";
+
+    cache::log("wrote trace to {}", g_trace_path);
+    g_trace_buffers.clear();
+}
@@ -0,0 +1,95 @@
+//
+//  FASTBuild Network Cache Plugin
+//
+//  Copyright © 2024 Don’t Nod Entertainment S.A. All rights reserved.
+//
+//  Authors: Sam Hocevar <sam@dont-nod.com>
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+//  and associated documentation files (the "Software"), to deal in the Software without restriction,
+//  including without limitation the rights to use, copy, modify, merge, publish, distribute,
+//  sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or
+//  substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+//  BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+//  DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+#include <atomic> // for std::atomic
+#include <chrono> // for std::chrono
+#include <string> // for std::string
+#include <string_view> // for std::string_view
+
+//
+// The trace class
+//
+// When enabled, spans are recorded into per-thread ring buffers, then written at
+// shutdown as Chrome trace event JSON, which can be loaded in chrome://tracing or
+// in Perfetto. Timestamps are relative to plugin initialisation.
+//
+
+class trace
+{
+public:
+    // A single recorded span; the backend name and ID are copied, since the
+    // backend may be destroyed before the trace is written
+    struct event
+    {
+        char const *name;
+        char backend[128];
+        char id[64];
+        std::chrono::steady_clock::time_point start, end;
+    };
+
+    // Measure the duration of an operation in the current thread, until the
+    // span is destroyed or stopped
+    class span
+    {
+    public:
+        span(char const *name, char const *backend = nullptr, std::string_view id = {});
+        ~span() { stop(); }
+
+        // Stop measuring and record the span
+        void stop();
+
+    private:
+        friend class trace;
+
+        event m_event;
+        bool m_active = false;
+    };
+
+    // Enable tracing if the configuration asks for it
+    static void init();
+
+    // Write all recorded spans to the trace file
+    static void flush();
+
+    // Whether tracing is enabled
+    static bool enabled() { return s_enabled; }
+
+    // The cache ID at the end of a request path
+    static std::string_view id(std::string_view path)
+    {
+        return path.substr(path.find_last_of('/') + 1);
+    }
+
+    // Record a span that was measured by other means
+    static void record(char const *name, char const *backend, std::string_view id,
+                       std::chrono::steady_clock::time_point start,
+                       std::chrono::steady_clock::time_point end);
+
+    // Record a span
+    static void record(event const &e);
+
+private:
+    static inline std::atomic<bool> s_enabled = false;
+};
@@ -21,40 +21,189 @@
 //  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 //
 
+#include "config.h"
+#include "http-engine.h"
+#include "throttle.h"
+#include "trace.h"
 #include "webdav-client.h"
 
+#include <algorithm> // for std::min()
+#include <cstdlib> // for std::atoi()
 #include <format> // for std::format()
+#include <future> // for std::async()
 
-httplib::Result webdav_client::options(std::filesystem::path const &path)
+// Conditional uploads at least this large wait for the server to accept them;
+// for smaller ones, the extra round trip costs more than sending the data
+static constexpr size_t expect_size = 64 << 10;
+
+// Number of TLS sessions kept for resumption; servers usually send a couple of
+// TLS 1.3 tickets per connection
+static constexpr size_t max_sessions = 16;
+
+// OpenSSL extra data indices, to find our client from OpenSSL callbacks, and to
+// flag handshakes that are in progress
+static int ctx_index()
+{
+    static int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return index;
+}
+
+static int ssl_index()
+{
+    static int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return index;
+}
+
+webdav_client::webdav_client(std::string const &url)
+  : m_url(url)
+{
+    // The event-driven engine only speaks plain HTTP
+    if (!g_config.get_bool("async_http", false) || !url.starts_with("http://"))
+        return;
+
+    auto host = url.substr(7);
+    int port = 80;
+    if (auto n = host.rfind(':'); n != std::string::npos && host.back() != ']')
+    {
+        port = std::atoi(host.c_str() + n + 1);
+        host.resize(n);
+    }
+
+    m_engine = std::make_unique<http_engine>(host, port, g_config.get_size("async_connections", 16),
+                                             m_connection_timeout);
+    if (!m_engine->start())
+        m_engine.reset();
+}
+
+webdav_client::~webdav_client()
+{
+    for (auto session : m_sessions)
+        SSL_SESSION_free(session);
+}
+
+httplib::Result webdav_client::options(std::string const &path)
 {
+    trace::span span("OPTIONS", m_url.c_str(), trace::id(path));
+    if (m_engine)
+        return submit("OPTIONS", path, {}).get();
     return wrap_request([&](httplib::Client &client)
     {
-        return client.Options(path.generic_string());
+        return client.Options(path);
     });
 }
 
-httplib::Result webdav_client::get(std::filesystem::path const &path)
+httplib::Result webdav_client::get(std::string const &path, std::string &body,
+                                   httplib::Headers const &headers)
 {
+    trace::span span("GET", m_url.c_str(), trace::id(path));
+    throttle::retrieve_guard guard;
+    if (m_engine)
+    {
+        auto ret = submit("GET", path, headers).get();
+        body.clear();
+        if (ret && ret->status == httplib::StatusCode::OK_200)
+            body = std::move(ret->body);
+        return ret;
+    }
+
     return wrap_request([&](httplib::Client &client)
     {
-        return client.Get(path.generic_string());
+        int status = -1;
+        std::chrono::steady_clock::time_point reply;
+        body.clear();
+        auto ret = client.Get(path, headers,
+            [&](httplib::Response const &res)
+            {
+                // Reserve the whole body at once if the server tells us its size; chunked
+                // replies will simply grow the buffer geometrically. Sizes that cannot be
+                // right cancel the request instead.
+                status = res.status;
+                reply = std::chrono::steady_clock::now();
+                if (status == httplib::StatusCode::OK_200 && res.has_header("Content-Length"))
+                {
+                    size_t size;
+                    if (!http_engine::parse_content_length(res.get_header_value("Content-Length"), size))
+                        return false;
+                    body.reserve(size);
+                }
+                return true;
+            },
+            [&](char const *data, size_t size)
+            {
+                // Ignore the body of error replies, e.g. before a HTTP 401 retry
+                if (status == httplib::StatusCode::OK_200)
+                    body.append(data, size);
+                return true;
+            });
+
+        // Separate the time spent waiting for the reply from the body transfer
+        if (trace::enabled() && status == httplib::StatusCode::OK_200)
+            trace::record("GET body", m_url.c_str(), trace::id(path),
+                          reply, std::chrono::steady_clock::now());
+        return ret;
     });
 }
 
-httplib::Result webdav_client::put(std::filesystem::path const &path, void const *data, size_t size)
+httplib::Result webdav_client::head(std::string const &path, httplib::Headers const &headers)
 {
+    trace::span span("HEAD", m_url.c_str(), trace::id(path));
+    if (m_engine)
+        return submit("HEAD", path, headers).get();
     return wrap_request([&](httplib::Client &client)
     {
-        return client.Put(path.generic_string(), static_cast<char const *>(data),
-                          size, "application/octet-stream");
+        return client.Head(path, headers);
     });
 }
 
-httplib::Result webdav_client::propfind(std::filesystem::path const &path, std::string const &depth)
+httplib::Result webdav_client::put(std::string const &path, void const *data, size_t size,
+                                   bool overwrite, httplib::Headers headers)
 {
+    trace::span span("PUT", m_url.c_str(), trace::id(path));
+    throttle::publish_guard guard;
+
+    if (!overwrite)
+        headers.insert({"If-None-Match", "*"});
+
+    // Throttled uploads need the chunked blocking path below
+    if (m_engine && !throttle::enabled())
+    {
+        // Let the server refuse a conditional upload before the body is sent
+        if (!overwrite && size >= expect_size)
+            headers.insert({"Expect", "100-continue"});
+        return submit("PUT", path, headers, std::string_view(static_cast<char const *>(data), size)).get();
+    }
+
+    if (!throttle::enabled())
+    {
+        return wrap_request([&](httplib::Client &client)
+        {
+            return client.Put(path, headers, static_cast<char const *>(data),
+                              size, "application/octet-stream");
+        });
+    }
+
+    // Send throttled data in small chunks, so that retrieves can get through
+    return wrap_request([&](httplib::Client &client)
+    {
+        return client.Put(path, headers, size,
+            [&](size_t offset, size_t length, httplib::DataSink &sink)
+            {
+                length = std::min(length, size_t(64 << 10));
+                throttle::acquire(length);
+                return sink.write(static_cast<char const *>(data) + offset, length);
+            }, "application/octet-stream");
+    });
+}
+
+httplib::Result webdav_client::propfind(std::string const &path, std::string const &depth)
+{
+    trace::span span("PROPFIND", m_url.c_str(), trace::id(path));
+    if (m_engine)
+        return submit("PROPFIND", path, {{"Depth", depth}}).get();
+
     httplib::Request req;
     req.method = "PROPFIND";
-    req.path = path.generic_string();
+    req.path = path;
     req.headers.insert({"Depth", depth});
     return wrap_request([&](httplib::Client &client)
     {
@@ -62,23 +211,75 @@ httplib::Result webdav_client::propfind(std::filesystem::path const &path, std::
     });
 }
 
-httplib::Result webdav_client::mkcol(std::filesystem::path const &path)
+httplib::Result webdav_client::mkcol(std::string const &path)
 {
+    trace::span span("MKCOL", m_url.c_str(), trace::id(path));
+    if (m_engine)
+        return submit("MKCOL", path, {}).get();
+
     httplib::Request req;
     req.method = "MKCOL";
-    req.path = path.generic_string();
+    req.path = path;
     return wrap_request([&](httplib::Client &client)
     {
         return client.send(std::move(req));
     });
 }
 
+httplib::Result webdav_client::send(char const *method, std::string const &path,
+                                    httplib::Headers const &headers, std::string_view body)
+{
+    trace::span span(method, m_url.c_str(), trace::id(path));
+    if (m_engine)
+        return submit(method, path, headers, body).get();
+
+    httplib::Request req;
+    req.method = method;
+    req.path = path;
+    req.headers = headers;
+    req.body = body;
+    return wrap_request([&](httplib::Client &client)
+    {
+        return client.send(req);
+    });
+}
+
 void webdav_client::set_basic_auth(std::string const &user, std::string const &pass)
 {
     m_user = user;
     m_pass = pass;
 }
 
+void webdav_client::set_connection_timeout(std::chrono::milliseconds timeout)
+{
+    m_connection_timeout = timeout;
+    if (m_engine)
+        m_engine->set_connection_timeout(timeout);
+}
+
+void webdav_client::prewarm(std::string const &path, int count)
+{
+    std::vector<std::future<void>> pending;
+    for (int i = 0; i < count; ++i)
+    {
+        pending.push_back(std::async(std::launch::async, [&]()
+        {
+            options(path);
+            release();
+        }));
+    }
+}
+
+void webdav_client::release()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (auto it = m_pool.find(std::this_thread::get_id()); it != m_pool.end())
+    {
+        m_spare.push_back(it->second);
+        m_pool.erase(it);
+    }
+}
+
 httplib::Result webdav_client::wrap_request(std::function<httplib::Result(httplib::Client &)> fn)
 {
     auto client = get_client();
@@ -91,18 +292,120 @@ httplib::Result webdav_client::wrap_request(std::function<httplib::Result(httpli
     return res;
 }
 
+std::future<httplib::Result> webdav_client::submit(char const *method, std::string const &path,
+                                                   httplib::Headers const &headers, std::string_view body)
+{
+    auto head = std::format("{} {} HTTP/1.1\r\n", method, path);
+    if (!headers.contains("Host"))
+        head += std::format("Host: {}\r\n", m_url.substr(7));
+    head += std::format("User-Agent: FASTBuild-NetCache/{}\r\n", VERSION);
+
+    // Credentials are sent upfront rather than after a HTTP 401 reply
+    if (!m_user.empty() && !headers.contains("Authorization"))
+    {
+        auto [name, value] = httplib::make_basic_authentication_header(m_user, m_pass);
+        head += std::format("{}: {}\r\n", name, value);
+    }
+
+    for (auto const &[name, value] : headers)
+        head += std::format("{}: {}\r\n", name, value);
+    if (!body.empty() || std::string_view(method) == "PUT" || std::string_view(method) == "POST")
+        head += std::format("Content-Type: application/octet-stream\r\nContent-Length: {}\r\n", body.size());
+    head += "\r\n";
+
+    return m_engine->submit(std::move(head), body, std::string_view(method) == "HEAD");
+}
+
 std::shared_ptr<httplib::Client> webdav_client::get_client()
 {
+    std::unique_lock<std::mutex> lock(m_mutex);
     auto it = m_pool.find(std::this_thread::get_id());
     if (it != m_pool.end())
         return it->second;
 
+    // Use an already connected client if there is one
+    if (!m_spare.empty())
+    {
+        auto client = m_spare.back();
+        m_spare.pop_back();
+        m_pool.insert({std::this_thread::get_id(), client});
+        return client;
+    }
+
     auto client = std::make_shared<httplib::Client>(m_url);
     client->set_default_headers({
         { "User-Agent", std::format("FASTBuild-NetCache/{}", VERSION) },
     });
+    if (auto ms = m_connection_timeout.count(); ms)
+        client->set_connection_timeout(ms / 1000, ms % 1000 * 1000);
+
+    // Let all TLS connections resume recent sessions, so that only the first one
+    // needs a full handshake. OpenSSL does not reuse client sessions by itself, so
+    // a session is set when a handshake starts.
+    if (SSL_CTX *ctx = client->ssl_context(); ctx)
+    {
+        SSL_CTX_set_ex_data(ctx, ctx_index(), this);
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx, &webdav_client::on_new_session);
+        SSL_CTX_set_info_callback(ctx, &webdav_client::on_tls_info);
+    }
 
-    std::unique_lock<std::mutex> lock(m_mutex);
     m_pool.insert({std::this_thread::get_id(), client});
     return client;
 }
+
+int webdav_client::on_new_session(SSL *ssl, SSL_SESSION *session)
+{
+    auto that = static_cast<webdav_client *>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ctx_index()));
+
+    // Keep a few recent sessions; returning 1 means we took ownership of it
+    std::unique_lock<std::mutex> lock(that->m_session_mutex);
+    if (that->m_sessions.size() >= max_sessions)
+    {
+        SSL_SESSION_free(that->m_sessions.front());
+        that->m_sessions.erase(that->m_sessions.begin());
+    }
+    that->m_sessions.push_back(session);
+    return 1;
+}
+
+void webdav_client::on_tls_info(SSL const *ssl, int where, int /* ret */)
+{
+    auto that = static_cast<webdav_client *>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ctx_index()));
+    auto s = const_cast<SSL *>(ssl);
+
+    // Handshakes happen synchronously in the connecting thread
+    static thread_local std::chrono::steady_clock::time_point start;
+
+    if ((where & SSL_CB_HANDSHAKE_START) && SSL_in_before(s))
+    {
+        start = std::chrono::steady_clock::now();
+        // TLS 1.3 tickets should only be used once, so they are taken out of the
+        // pool; older sessions can be resumed by any number of connections
+        std::unique_lock<std::mutex> lock(that->m_session_mutex);
+        if (!that->m_sessions.empty())
+        {
+            auto session = that->m_sessions.back();
+            SSL_set_session(s, session);
+            if (SSL_SESSION_get_protocol_version(session) >= TLS1_3_VERSION)
+            {
+                SSL_SESSION_free(session);
+                that->m_sessions.pop_back();
+            }
+        }
+        SSL_set_ex_data(s, ssl_index(), that);
+    }
+
+    // TLS 1.3 may report several completed handshakes for a single connection
+    if ((where & SSL_CB_HANDSHAKE_DONE) && SSL_get_ex_data(s, ssl_index()))
+    {
+        SSL_set_ex_data(s, ssl_index(), nullptr);
+        that->m_handshakes += 1;
+        if (SSL_session_reused(s))
+            that->m_resumed += 1;
+
+        if (trace::enabled())
+            trace::record(SSL_session_reused(s) ? "TLS resumption" : "TLS handshake", that->m_url.c_str(),
+                          {}, start, std::chrono::steady_clock::now());
+    }
+}
@@ -26,59 +26,114 @@
 #define CPPHTTPLIB_OPENSSL_SUPPORT
 #include <httplib.h>
 
+#include <openssl/ssl.h> // for SSL_SESSION
+
+#include <atomic> // for std::atomic
+#include <chrono> // for std::chrono
+#include <future> // for std::future
 #include <memory> // for std::shared_ptr
 #include <string> // for std::string
 #include <thread> // for std::mutex
-#include <filesystem> // for std::filesystem::path
+#include <vector> // for std::vector
 #include <unordered_map> // for std::unordered_map
 
 //
-// HTTP/WebDAV client that creates a new connection for each calling thread
+// HTTP/WebDAV client that creates a new connection for each calling thread;
+// connections resume recent TLS sessions to avoid full handshakes. For
+// plain HTTP servers, requests may instead go through an event-driven engine
+// that multiplexes all threads over a few connections.
 //
 
 class webdav_client
 {
 public:
-    webdav_client(std::string const &url)
-      : m_url(url)
-    {}
+    webdav_client(std::string const &url);
+
+    ~webdav_client();
 
     // Send an HTTP OPTIONS request, to test the connection.
-    httplib::Result options(std::filesystem::path const &path);
+    httplib::Result options(std::string const &path);
 
-    // Send an HTTP GET request, to retrieve a file from the remote server.
-    httplib::Result get(std::filesystem::path const &path);
+    // Send an HTTP GET request, to retrieve a file from the remote server. The body is
+    // streamed directly into the given buffer, presized using the Content-Length header.
+    httplib::Result get(std::string const &path, std::string &body, httplib::Headers const &headers = {});
 
-    // Send an HTTP PUT request, to store a file on the remote server.
-    httplib::Result put(std::filesystem::path const &path, void const *data, size_t size);
+    // Send an HTTP HEAD request, to check whether a file exists on the remote server.
+    httplib::Result head(std::string const &path, httplib::Headers const &headers = {});
+
+    // Send an HTTP PUT request, to store a file on the remote server. Unless overwrite
+    // is true, the server answers HTTP 412 instead if the file already exists.
+    httplib::Result put(std::string const &path, void const *data, size_t size,
+                        bool overwrite = true, httplib::Headers headers = {});
 
     // Send a WebDAV PROPFIND request, to get information about a directory.
     // The depth argument can only be 0, 1, or infinity.
-    httplib::Result propfind(std::filesystem::path const &path, std::string const &depth);
+    httplib::Result propfind(std::string const &path, std::string const &depth);
 
     // Send a WebDAV MKCOL request, to create a directory.
-    httplib::Result mkcol(std::filesystem::path const &path);
+    httplib::Result mkcol(std::string const &path);
+
+    // Send any other HTTP request with an optional body, e.g. for protocols built on HTTP.
+    httplib::Result send(char const *method, std::string const &path, httplib::Headers const &headers,
+                         std::string_view body = {});
 
     // Set a username and a password for all subsequent HTTP connections.
     void set_basic_auth(std::string const &user, std::string const &pass);
 
+    // Set the connection timeout for all subsequent HTTP connections.
+    void set_connection_timeout(std::chrono::milliseconds timeout);
+
+    // Open connections in advance, for use by threads that do not have one yet.
+    void prewarm(std::string const &path, int count);
+
+    // Give the current thread’s connection to the next thread that needs one.
+    void release();
+
+    // Number of TLS handshakes, and how many of them resumed a previous session
+    size_t handshakes() const { return m_handshakes; }
+    size_t resumed() const { return m_resumed; }
+
 protected:
     // Request wrapper for seamless HTTP 401 handling.
     httplib::Result wrap_request(std::function<httplib::Result(httplib::Client &)> fn);
 
+    // Queue a request in the event-driven engine.
+    std::future<httplib::Result> submit(char const *method, std::string const &path,
+                                        httplib::Headers const &headers, std::string_view body = {});
+
     // Return the current thread’s web client, or create one if necessary.
     std::shared_ptr<httplib::Client> get_client();
 
+    // OpenSSL callbacks for TLS session sharing and handshake tracking
+    static int on_new_session(SSL *ssl, SSL_SESSION *session);
+    static void on_tls_info(SSL const *ssl, int where, int ret);
+
 private:
     // Base URL to connect to (protocol, server name, port)
     std::string m_url;
 
+    // Event-driven engine, if enabled and supported for this server
+    std::unique_ptr<class http_engine> m_engine;
+
     // Network cache credentials, if any
     std::string m_user, m_pass;
 
+    // Connection timeout, or zero for the default
+    std::chrono::milliseconds m_connection_timeout { 0 };
+
     // Per-thread collection of web clients
     std::unordered_map<std::thread::id, std::shared_ptr<httplib::Client>> m_pool;
 
-    // Protect m_pool against concurrent writes
+    // Connected web clients not used by any thread yet
+    std::vector<std::shared_ptr<httplib::Client>> m_spare;
+
+    // Protect m_pool and m_spare against concurrent writes
     std::mutex m_mutex;
+
+    // Recent TLS sessions, used to resume new connections
+    std::vector<SSL_SESSION *> m_sessions;
+    std::mutex m_session_mutex;
+
+    // TLS handshake statistics
+    std::atomic<size_t> m_handshakes = 0, m_resumed = 0;
 };